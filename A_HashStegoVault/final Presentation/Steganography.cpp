@@ -9,6 +9,14 @@
 //#include<windows.h>
 //#include<wincon.h>
 #include<sstream>
+#include<fcntl.h>
+#include<unistd.h>
+#include<sys/mman.h>
+#include<sys/stat.h>
+#include<sys/ioctl.h>
+#ifdef __linux__
+#include<linux/fs.h>
+#endif
 
 using namespace std;
 
@@ -52,23 +60,144 @@ struct bmpColorTable
     unsigned int colorDefinition[256];
 };
 
-struct Image{          /** image info if needed **/
-    int height;
-    int width;
-    struct RGB **rgb;
+/** whole bmp held in memory, shared by hiding and extracting.
+    pixels is the padded pixel array exactly as stored in the file,
+    one byte per channel in b,g,r order, so it is loaded and written in one go.
+**/
+struct Image{
+    int height{0};          /** dibheader.height, pixels in one scanline **/
+    int width{0};           /** dibheader.width, number of scanlines **/
+    int rowStride{0};       /** bytes per scanline including padding **/
+    vector<unsigned char> header;   /** every byte before the pixel array **/
+    vector<unsigned char> pixels;   /** padded pixel array **/
+    vector<unsigned char> trailer;  /** every byte after the pixel array **/
+};
+
+/** bits packed msb first into bytes, the form the lsb kernels read **/
+struct BitStream{
+    vector<unsigned char> bytes;
+    long long bitCount{0};
+};
+
+/** what hidingDataAndHash learned from its one pass over the text file **/
+struct HideResult{
+    string stegoImage{" "};         /** " " when no stego image was written **/
+    long long capacity{0};          /** carriers in the image, length bits included **/
+    long long payloadBytes{0};
+    bool fits{false};               /** the text fit the image **/
+    unsigned char digest[64]{};     /** sha-512 of the text file **/
+};
+
+/** what extractingDataAndVerify found in its one pass over the carriers **/
+enum VerifyVerdict{
+    verifyNoDigest=0,       /** nothing to compare with **/
+    verifyMatch=1,
+    verifyMismatch=2
+};
+
+struct ExtractResult{
+    bool found{false};              /** a message or file was extracted **/
+    string outputFile;              /** where it was saved **/
+    long long payloadBytes{0};
+    unsigned char digest[64]{};     /** sha-512 of the extracted bytes **/
+    int verdict{verifyNoDigest};
+};
+
+/** carrier order. the 32 length bits fill pixels 0 to 10, then every
+    following row of the payload restarts at the column where the length
+    bits stopped. so the carriers are runs of consecutive channels: one run
+    up to the end of the row holding the length bits, then one per row.
+**/
+struct CarrierLayout{
+    long long rowChannels{0};       /** channels in one row **/
+    long long firstRunEnd{0};       /** carriers in the first run **/
+    long long restartChannel{0};    /** channel of its row every later run starts at **/
+    long long capacity{0};          /** carriers in total, length bits included **/
+};
+
+/** record written by hidingFile in place of the 32 bit text length, every
+    field big endian: magic(4) version(1) flags(1) payloadType(1)
+    nameLength(2) payloadLength(8) and then the name. the magic has its top
+    bit set, so a build that only knows text reads a negative length and
+    reports that no message is hidden.
+    the low two flag bits hold depth-1, the number of lsbs every payload
+    carrier takes. the record itself always takes one lsb per carrier.
+    with payloadMacFlag set, 64 bytes of HMAC-SHA512 come between the fixed
+    fields and the name. the mac covers the fixed fields, the name and the
+    payload, so none of them can be changed without the key.
+    with payloadDigestFlag set, the 64 byte SHA-512 of the payload comes
+    next, so extraction can check the payload without any other file. the
+    mac takes in the digest last, after the payload.
+**/
+const unsigned int payloadMagic=0xD3564C54;
+const int payloadVersion=1;
+const int payloadRecordSize=17;     /** bytes in front of the name **/
+const int payloadDepthMask=0x03;
+const int payloadMacFlag=0x04;
+const int payloadDigestFlag=0x08;
+const int payloadMacSize=64;
+const int payloadDigestSize=64;
+const int maximumDepth=4;
+
+/** images from this size on are not loaded whole, writeStegoImage copies
+    them and writes only the carrier pages, or streams them when that fails
+**/
+const long long largeImageSize=256LL<<20;
+
+enum PayloadType{
+    payloadText=0,
+    payloadBinary=1
+};
+
+struct PayloadRecord{
+    int version{payloadVersion};
+    int flags{0};
+    int payloadType{payloadBinary};
+    int depth{1};                           /** lsbs per payload carrier, 1 to 4 **/
+    string fileName;
+    unsigned long long payloadLength{0};    /** bytes **/
+    unsigned char mac[64]{};                /** with payloadMacFlag only **/
+    unsigned char digest[64]{};             /** with payloadDigestFlag only **/
 };
 
 int checkingImageFormat(string fileName);
 int checkingTextFile(string imageFile,string textFile);
 string addImageFileExtension(string imageFileName);
 string addTextFileExtension(string textFileName);
-string hidingData(string imageFile,string textFile);
-vector<int> textToBinary(string textFile);
-void extractingData(string imageFile);
-vector<int> decimalToBinary(int decimalValue);
-int binaryToDecimal(int binArray[],int length);
+HideResult hidingDataAndHash(string imageFile,string textFile,int threadCount=0);
+BitStream textToBinary(string textFile);
+void extractingData(string imageFile,int threadCount=0,string key="");
+ExtractResult extractingDataAndVerify(string imageFile,const unsigned char *expected=NULL,int threadCount=0,string key="");
+BitStream decimalToBinary(int decimalValue);
 void openingImage(string fileName);
 void processInputText(string textFile);
+int loadImageHeader(ifstream &inputFile,Image &image,long long &fileSize);
+int loadImage(string imageFile,Image &image);
+int saveImage(string imageFile,const Image &image);
+string stegoImageName(string imageFile);
+long long carrierCapacity(int height,int width);
+CarrierLayout carrierLayout(int height,int width);
+long long carrierChannel(const CarrierLayout &layout,long long carrier,long long &runLeft);
+long long carrierAtChannel(const CarrierLayout &layout,long long channel);
+long long depthCarriers(long long bitCount,int depth);
+void embedCarriers(unsigned char *pixels,long long base,const CarrierLayout &layout,long long carrier,long long count,const unsigned char *bits,long long bitPos,int depth=1);
+void extractCarriers(const unsigned char *pixels,long long base,const CarrierLayout &layout,long long carrier,long long count,unsigned char *bits,long long bitPos,int depth=1);
+int copyImageFile(string sourceFile,string targetFile);
+int readPixelRange(int fd,long long offset,vector<unsigned char> &buffer);
+void forEachBand(long long carrier,long long count,long long bitPos,int depth,int threadCount,function<void(long long,long long,long long)> work);
+string writeStegoImage(string imageFile,const BitStream &header,const BitStream &payload,int depth,int threadCount);
+string writeStegoImageStreaming(string imageFile,const BitStream &header,const BitStream &payload,int depth);
+string writeStegoImageInPlace(string imageFile,const BitStream &header,const BitStream &payload,int depth,int threadCount);
+string hidingFile(string imageFile,string payloadFile,int depth=1,int threadCount=0,string key="",bool embedDigest=false);
+int checkingPayloadFile(string imageFile,string payloadFile,int depth,int flags=0);
+long long payloadHeaderSize(int flags,long long nameLength);
+BitStream fileToBinary(string payloadFile,function<void(const unsigned char *,size_t)> consume=nullptr);
+BitStream payloadHeader(const PayloadRecord &record);
+int parsePayloadRecord(const unsigned char *bytes,PayloadRecord &record,int &nameLength);
+string payloadBaseName(string path);
+int readCarriers(int fd,long long offset,const CarrierLayout &layout,long long carrier,long long count,unsigned char *bits,long long bitPos,int threadCount,int depth=1);
+void extractingFile(int fd,long long offset,const CarrierLayout &layout,int threadCount,string key,const unsigned char *expected,ExtractResult &result);
+void payloadMacStart(HMACSHA512Context &mac,const PayloadRecord &record,string key);
 
 
 int checkingImageFormat(string imageFile)
@@ -114,56 +243,85 @@ int checkingImageFormat(string imageFile)
 }
 int checkingTextFile(string imageFile,string textFile)
 {
-    /** gaining image height and width **/
+    /** only the image header and the text file size are needed **/
+    struct Image image;
+
     ifstream inputFile;
     inputFile.open(imageFile.c_str(),ios::binary);
 
-    struct BMPSignature bmpsignature;
-    struct BitMapHeader bitmapheader;
-    struct DIBHeader dibheader;
-
-    inputFile.read((char *)&bmpsignature,sizeof(bmpsignature));
-    inputFile.read((char *)&bitmapheader,sizeof(bitmapheader));
-    inputFile.read((char *)&dibheader,sizeof(dibheader));
+    long long fileSize;
+    if(!inputFile or !loadImageHeader(inputFile,image,fileSize))
+    {
+        return 0;
+    }
 
-    int imageHeight=dibheader.height;
-    int imageWidth=dibheader.width;
+    inputFile.close();
 
 
     /** text file section **/
 
-    FILE *fp1=fopen(textFile.c_str(),"r");
-    if(fp1==NULL)
+    struct stat info;
+    if(stat(textFile.c_str(),&info)!=0)
     {
         printf("Error opening file %s", textFile.c_str());
         return 0;
     }
 
-    /** checking text file size **/
-    long long int textFileSize;
-    int countCharacter=0;
-    char ch;
+    long long textFileSize=8LL*info.st_size;
+
+    /** checking available space in bits for hiding these text file.
+        the length has to fit the 32 bit header too.
+    **/
 
-    while((ch=fgetc(fp1)!=EOF))
+    if(textFileSize<=INT_MAX and carrierCapacity(image.height,image.width)>=(textFileSize+32))
+    {
+        return 1;
+    }
+    else
     {
-        countCharacter++;
+        return 0;
     }
+}
+int checkingPayloadFile(string imageFile,string payloadFile,int depth,int flags)
+{
+    /** payload record, name and payload at depth lsbs per carrier **/
+    struct Image image;
 
-    fclose(fp1);
+    ifstream inputFile;
+    inputFile.open(imageFile.c_str(),ios::binary);
+
+    long long fileSize;
+    if(!inputFile or !loadImageHeader(inputFile,image,fileSize))
+    {
+        return 0;
+    }
 
+    struct stat info;
+    if(depth<1 or depth>maximumDepth or stat(payloadFile.c_str(),&info)!=0)
+    {
+        return 0;
+    }
 
-    textFileSize=countCharacter*8;
+    long long headerCarriers=8LL*payloadHeaderSize(flags,payloadBaseName(payloadFile).size());
+    long long payloadCarriers=depthCarriers(8LL*info.st_size,depth);
 
-    /** checking available space in bits for hiding these text file.**/
+    return carrierCapacity(image.height,image.width)>=headerCarriers+payloadCarriers;
+}
+long long payloadHeaderSize(int flags,long long nameLength)
+{
+    /** bytes of the record, mac, digest and name **/
+    long long size=payloadRecordSize+nameLength;
 
-    if((imageHeight * imageWidth *3)>(textFileSize+32))
+    if(flags&payloadMacFlag)
     {
-        return 1;
+        size+=payloadMacSize;
     }
-    else
+    if(flags&payloadDigestFlag)
     {
-        return 0;
+        size+=payloadDigestSize;
     }
+
+    return size;
 }
 string addImageFileExtension(string imageFileName)
 {
@@ -183,30 +341,107 @@ string addTextFileExtension(string textFileName)
 
     return textFileName;
 }
-string hidingData(string imageFile,string textFile)
+int loadImageHeader(ifstream &inputFile,Image &image,long long &fileSize)
 {
-    /** text file to binary stream **/
+    /** reads and checks everything before the pixel array and leaves
+        inputFile at the first pixel byte
+    **/
+    struct BMPSignature bmpsignature;
+    struct BitMapHeader bitmapheader;
+    struct DIBHeader dibheader;
 
-    vector<int> binaryStream=textToBinary(textFile);
-    //cout<<binaryStream.size()<<"\n";
-    /* for(int i=1;i<=binaryStream.size();i++)
-     {
-         cout<<binaryStream[i-1]<<" ";
-         if(i%8==0) puts("");
-     }*/
+    inputFile.read((char *)&bmpsignature,sizeof(bmpsignature));
+    inputFile.read((char *)&bitmapheader,sizeof(bitmapheader));
+    inputFile.read((char *)&dibheader,sizeof(dibheader));
 
+    if(!inputFile)
+    {
+        return 0;
+    }
 
-    /** image read and copy information **/
+    inputFile.seekg(0,ios::end);
+    fileSize=inputFile.tellg();
 
-    struct BitMapHeader bitmapheader;
-    struct DIBHeader dibheader;
-    struct RGB rgb;
-    struct bmpColorTable bmpcolortable;
-    struct BMPSignature bmpsignature;
+    image.height=dibheader.height;
+    image.width=dibheader.width;
+
+    /** every scanline is padded up to a multiple of 4 bytes **/
+    image.rowStride=(image.height*3+3)/4*4;
+
+    long long offset=bitmapheader.imageOffset;
+    long long pixelArraySize=(long long)image.rowStride*image.width;
+    long long headerSize=sizeof(bmpsignature)+sizeof(bitmapheader)+sizeof(dibheader);
+
+    if(image.height<=0 or image.width<=0 or offset<headerSize or offset+pixelArraySize>fileSize)
+    {
+        return 0;
+    }
 
+    image.header.resize(offset);
+
+    inputFile.seekg(0,ios::beg);
+    inputFile.read((char *)image.header.data(),image.header.size());
+
+    if(!inputFile)
+    {
+        return 0;
+    }
+
+    return 1;
+}
+int loadImage(string imageFile,Image &image)
+{
     ifstream inputFile;
+    inputFile.open(imageFile.c_str(),ios::binary);
+
+    long long fileSize;
+    if(!inputFile or !loadImageHeader(inputFile,image,fileSize))
+    {
+        return 0;
+    }
+
+    long long pixelArraySize=(long long)image.rowStride*image.width;
+    image.pixels.resize(pixelArraySize);
+    image.trailer.resize(fileSize-image.header.size()-pixelArraySize);
+
+    /** the pixel array comes in as a single block **/
+    inputFile.read((char *)image.pixels.data(),image.pixels.size());
+    inputFile.read((char *)image.trailer.data(),image.trailer.size());
+
+    if(!inputFile)
+    {
+        return 0;
+    }
+
+    inputFile.close();
+
+    return 1;
+}
+int saveImage(string imageFile,const Image &image)
+{
     ofstream outputFile;
+    outputFile.open(imageFile.c_str(),ios::binary);
+
+    if(!outputFile)
+    {
+        return 0;
+    }
+
+    outputFile.write((const char *)image.header.data(),image.header.size());
+    outputFile.write((const char *)image.pixels.data(),image.pixels.size());
+    outputFile.write((const char *)image.trailer.data(),image.trailer.size());
+
+    if(!outputFile)
+    {
+        return 0;
+    }
+
+    outputFile.close();
 
+    return 1;
+}
+string stegoImageName(string imageFile)
+{
     // modification
     string outputImage="stegoBMP";
     for(int i=imageFile.size()-1;i>-1;i--)
@@ -224,489 +459,1013 @@ string hidingData(string imageFile,string textFile)
     outputImage+='m';
     outputImage+='p';
 
-    inputFile.open(imageFile,ios::binary);
-    outputFile.open(outputImage,ios::binary);
+    return outputImage;
+}
+long long carrierCapacity(int height,int width)
+{
+    /** number of carrier bytes, length bits included **/
+    return carrierLayout(height,width).capacity;
+}
+CarrierLayout carrierLayout(int height,int width)
+{
+    struct CarrierLayout layout;
+    long long headerRow=10/width;
 
-    inputFile.read((char *)&bmpsignature,sizeof(bmpsignature));
-    inputFile.read((char *)&bitmapheader,sizeof(bitmapheader));
-    inputFile.read((char *)&dibheader,sizeof(dibheader));
-    inputFile.read((char *)&rgb,sizeof(rgb));
+    layout.rowChannels=3LL*width;
+    layout.firstRunEnd=(headerRow+1)*layout.rowChannels;
+    layout.restartChannel=3*(10%width);
 
-    outputFile.write((char *)&bmpsignature,sizeof(bmpsignature));
-    outputFile.write((char *)&bitmapheader,sizeof(bitmapheader));
-    outputFile.write((char *)&dibheader,sizeof(dibheader));
-    outputFile.write((char *)&rgb,sizeof(rgb));
+    if(headerRow<height)
+    {
+        layout.capacity=layout.firstRunEnd+(height-headerRow-1)*(layout.rowChannels-layout.restartChannel);
+    }
 
-    int height=dibheader.height;
-    int width=dibheader.width;
+    return layout;
+}
+long long carrierChannel(const CarrierLayout &layout,long long carrier,long long &runLeft)
+{
+    if(carrier<layout.firstRunEnd)
+    {
+        runLeft=layout.firstRunEnd-carrier;
+        return carrier;
+    }
 
+    long long runLength=layout.rowChannels-layout.restartChannel;
+    long long row=(carrier-layout.firstRunEnd)/runLength;
+    long long column=(carrier-layout.firstRunEnd)%runLength;
 
-    int*** pixels = new int** [height];
-    for(int i = 0; i<height; i++)
+    runLeft=runLength-column;
+    return layout.firstRunEnd+row*layout.rowChannels+layout.restartChannel+column;
+}
+long long carrierAtChannel(const CarrierLayout &layout,long long channel)
+{
+    /** first carrier whose channel is at or after the given one **/
+    if(channel<layout.firstRunEnd)
     {
-        pixels[i] = new int* [width];
-        for(int j = 0; j<width; j++)
-        {
-            pixels[i][j] = new int[3];
-        }
+        return channel;
     }
 
-    inputFile.seekg(bitmapheader.imageOffset,ios::beg);
-    outputFile.seekp(bitmapheader.imageOffset,ios::beg);
+    long long runLength=layout.rowChannels-layout.restartChannel;
+    long long row=(channel-layout.firstRunEnd)/layout.rowChannels;
+    long long column=(channel-layout.firstRunEnd)%layout.rowChannels;
 
-    for(int i=0; i<height; i++)
+    return layout.firstRunEnd+row*runLength+max(0LL,column-layout.restartChannel);
+}
+long long depthCarriers(long long bitCount,int depth)
+{
+    /** carriers taken by bitCount payload bits at depth lsbs per carrier **/
+    return (bitCount+depth-1)/depth;
+}
+void embedCarriers(unsigned char *pixels,long long base,const CarrierLayout &layout,long long carrier,long long count,const unsigned char *bits,long long bitPos,int depth)
+{
+    /** pixels points at byte base of the pixel array, base is a multiple of 3 **/
+    while(count>0)
     {
-        for(int j=0; j<width; j++)
-        {
-            unsigned char color[3];
-            inputFile.read(reinterpret_cast<char*>(color),3);
-            pixels[i][j][0] = static_cast<float>(color[2]); //red
-            pixels[i][j][1] = static_cast<float>(color[1]); //green
-            pixels[i][j][2] = static_cast<float>(color[0]); //blue
-        }
+        long long runLeft;
+        long long channel=carrierChannel(layout,carrier,runLeft);
+        long long n=min(runLeft,count);
+
+        if(depth==1)
+            embedChannels(pixels,channel-base,n,bits,bitPos);
+        else
+            embedChannelsDepth(pixels,channel-base,n,bits,bitPos,depth);
+
+        carrier+=n;
+        bitPos+=n*depth;
+        count-=n;
     }
+}
+void extractCarriers(const unsigned char *pixels,long long base,const CarrierLayout &layout,long long carrier,long long count,unsigned char *bits,long long bitPos,int depth)
+{
+    while(count>0)
+    {
+        long long runLeft;
+        long long channel=carrierChannel(layout,carrier,runLeft);
+        long long n=min(runLeft,count);
+
+        if(depth==1)
+            extractChannels(pixels,channel-base,n,bits,bitPos);
+        else
+            extractChannelsDepth(pixels,channel-base,n,bits,bitPos,depth);
+
+        carrier+=n;
+        bitPos+=n*depth;
+        count-=n;
+    }
+}
+void forEachBand(long long carrier,long long count,long long bitPos,int depth,int threadCount,function<void(long long,long long,long long)> work)
+{
+    /** splits the carriers into one band per thread. every band after the
+        first starts on a payload byte, so no two threads touch the same
+        payload byte or the same carrier and the result equals the serial one.
+    **/
+    const long long minimumBand=1<<20;
 
+    if(threadCount<=0)
+    {
+        threadCount=thread::hardware_concurrency();
+    }
 
-    /** doing pixel decimal value to bin and embedding text binary value together **/
-    int p=0;
-    int sizeOfStream=binaryStream.size();
-    vector<int>flagStreams=decimalToBinary(sizeOfStream);
-    bool ok=false;
-
+    long long bands=min<long long>(threadCount,count/minimumBand);
+    if(bands<=1)
+    {
+        work(carrier,count,bitPos);
+        return;
+    }
 
-    /** at first embedding the text file size **/
+    /** bands are whole 48 carrier blocks so each vector kernel stays aligned **/
+    long long bandSize=(count/bands+383)/384*384;
 
-    int a,b,c,d;
+    vector<thread> workers;
+    long long start=0;
 
-    for(a=0; a<height; a++)
+    while(start<count)
     {
-        for(b=0; b<width; b++)
+        /** move the end back until the next band starts on a payload byte **/
+        long long end=min(count,start+bandSize);
+        while(end>start and end<count and (bitPos+end*depth)%8!=0)
         {
-            d=0;
-            while(d<3)
-            {
-                if(p==32)
-                {
-                    ok=true;
-                    break;
-                }
-                int quotient=pixels[a][b][d];
-                //cout<<"#"<<pixels[a][b][d]<<"\n";
-                int remainder;
-                int binary[8];
-                int k=7;
-                while(quotient)
-                {
-                    remainder=quotient%2;
-                    binary[k]=remainder;
-                    k--;
-                    quotient/=2;
-                }
-
-                while(k>=0)
-                {
-                    binary[k]=0;
-                    k--;
-                }
-
-                binary[7]=flagStreams[p];
-                p++;
-
-                /** bin to int and embedding**/
-                int power=0;
-                pixels[a][b][d]=0;
-                for(int t=0; t<8; t++)
-                {
-                    pixels[a][b][d]+=(binary[t]*pow(2,(7-t)));
-                }
-
-                d++;
-            }
-            if(ok)
-                break;
+            end--;
         }
-        if(ok)
-            break;
+        if(end==start or count-end<8)
+        {
+            end=count;
+        }
+
+        workers.push_back(thread(work,carrier+start,end-start,bitPos+start*depth));
+        start=end;
     }
 
-    /** for data **/
-    p=0;
-    bool cnt=true;
-    ok=false;
+    for(size_t i=0; i<workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+string writeStegoImage(string imageFile,const BitStream &header,const BitStream &payload,int depth,int threadCount)
+{
+    /** image read and copy information **/
 
-    for(int i=a; i<height; i++)
+    struct stat info;
+    if(stat(imageFile.c_str(),&info)==0 and info.st_size>=largeImageSize)
     {
-        for(int j=b; j<width; j++)
+        string outputImage=writeStegoImageInPlace(imageFile,header,payload,depth,threadCount);
+        if(outputImage==" ")
         {
-            if(cnt==true and d!=0)
-            {
-                c=d;
-                cnt=false;
-            }
-            else
-            {
-                c=0;
-            }
-            while(c<3)
-            {
-                if(p==sizeOfStream)
-                {
-                    ok=true;
-                    break;
-                }
-                int quotient=pixels[i][j][c];
-                //cout<<"#hiding "<<quotient;
-                int remainder;
-                int binary[8];
-                int k=7;
-                while(quotient)
-                {
-                    remainder=quotient%2;
-                    binary[k]=remainder;
-                    k--;
-                    quotient/=2;
-                }
-
-                while(k>=0)
-                {
-                    binary[k]=0;
-                    k--;
-                }
-
-                binary[7]=binaryStream[p];
-                p++;
-
-                /** bin to int and embedding **/
-                int power=0;
-                pixels[i][j][c]=0;
-
-                for(int t=0; t<8; t++)
-                {
-                    pixels[i][j][c]+=(binary[t]*pow(2,(7-t)));
-                }
-
-                //cout<<"  new #hiding "<<pixels[a][b][c]<<"\n";
-                c++;
-            }
-            if(ok)
-                break;
+            outputImage=writeStegoImageStreaming(imageFile,header,payload,depth);
         }
-        if(ok)
-            break;
+        return outputImage;
     }
 
+    struct Image image;
+    string outputImage=stegoImageName(imageFile);
 
-    /** writing the image **/
-    for(int i=0; i<height; i++)
+    if(!loadImage(imageFile,image))
     {
-        for(int j=0; j<width; j++)
-        {
-            unsigned char color[3];
-            color[0] = static_cast<unsigned char>(pixels[i][j][2]);
-            color[1] = static_cast<unsigned char>(pixels[i][j][1]);
-            color[2] = static_cast<unsigned char>(pixels[i][j][0]);
-            outputFile.write(reinterpret_cast<char*>(color),3);
-        }
+        return " ";
     }
 
-    inputFile.read((char*)&bmpcolortable,sizeof(bmpcolortable));
-    outputFile.write((char*)&bmpcolortable,sizeof(bmpcolortable));
-
-    inputFile.close();
-    outputFile.close();
+    int height=image.height;
+    int width=image.width;
 
-    return outputImage;
-}
-void extractingData(string imageFile)
-{
-    /** image read and copy information **/
 
-    struct BitMapHeader bitmapheader;
-    struct DIBHeader dibheader;
-    struct RGB rgb;
-    struct bmpColorTable bmpcolortable;
-    struct BMPSignature bmpsignature;
+    /** embedding the binary value in the lsb of each carrier byte **/
+    long long headerCarriers=header.bitCount;
+    long long payloadCarriers=depthCarriers(payload.bitCount,depth);
 
-    ifstream inputFile;
+    struct CarrierLayout layout=carrierLayout(height,width);
 
-    inputFile.open(imageFile,ios::binary);
+    if(payloadCarriers+headerCarriers>layout.capacity)
+    {
+        return " ";
+    }
 
-    inputFile.read((char *)&bmpsignature,sizeof(bmpsignature));
-    inputFile.read((char *)&bitmapheader,sizeof(bitmapheader));
-    inputFile.read((char *)&dibheader,sizeof(dibheader));
-    inputFile.read((char *)&rgb,sizeof(rgb));
+    const unsigned char *headerBits=header.bytes.data();
+    const unsigned char *dataBits=payload.bytes.data();
 
+    /** at first embedding the header, then the data **/
+    embedCarriers(image.pixels.data(),0,layout,0,headerCarriers,headerBits,0);
+    forEachBand(headerCarriers,payloadCarriers,0,depth,threadCount,[&](long long carrier,long long count,long long bitPos)
+    {
+        embedCarriers(image.pixels.data(),0,layout,carrier,count,dataBits,bitPos,depth);
+    });
 
-    int height=dibheader.height;
-    int width=dibheader.width;
 
-    int*** pixels2 = new int** [height];
-    for(int i = 0; i<height; i++)
+    /** writing the image **/
+    if(!saveImage(outputImage,image))
     {
-        pixels2[i] = new int* [width];
-        for(int j = 0; j<width; j++)
-        {
-            pixels2[i][j] = new int[3];
-        }
+        return " ";
     }
 
-    inputFile.seekg(bitmapheader.imageOffset,ios::beg);
+    return outputImage;
+}
+HideResult hidingDataAndHash(string imageFile,string textFile,int threadCount)
+{
+    /** one read of the text file feeds both the hash and the embedding,
+        the capacity comes from the image header
+    **/
+    HideResult result;
+    struct Image image;
+
+    ifstream inputFile;
+    inputFile.open(imageFile.c_str(),ios::binary);
 
-    for(int i=0; i<height; i++)
+    long long fileSize;
+    if(!inputFile or !loadImageHeader(inputFile,image,fileSize))
     {
-        for(int j=0; j<width; j++)
-        {
-            unsigned char color[3];
-            inputFile.read(reinterpret_cast<char*>(color),3);
-            pixels2[i][j][0] = static_cast<float>(color[2]); //red
-            pixels2[i][j][1] = static_cast<float>(color[1]); //green
-            pixels2[i][j][2] = static_cast<float>(color[0]); //blue
-        }
+        return result;
     }
 
+    inputFile.close();
 
-    /** doing pixel decimal value to binary and extracting info **/
-    int p=0;
+    result.capacity=carrierCapacity(image.height,image.width);
 
-    bool ok=false;
+    SHA512Context hash;
+    sha512Init(hash);
 
-    int a,b,c,d;
-    int tempBin[32];
-    for(a=0; a<height; a++)
+    BitStream binaryStream=fileToBinary(textFile,[&](const unsigned char *data,size_t size)
     {
-        for(b=0; b<width; b++)
-        {
-            d=0;
-            while(d<3)
-            {
-                if(p==32)
-                {
-                    ok=true;
-                    break;
-                }
-                int quotient=pixels2[a][b][d];
-               // cout<<"*"<<quotient<<"\n";
-                int remainder;
-                int binary[8];
-                int k=7;
-                while(quotient)
-                {
-                    remainder=quotient%2;
-                    binary[k]=remainder;
-                    k--;
-                    quotient/=2;
-                }
-
-                while(k>=0)
-                {
-                    binary[k]=0;
-                    k--;
-                }
-
-                tempBin[p]=binary[7];
-                p++;
-
-                /** bin to int, leaving the stego image as it is **/
-                int power=0;
-                pixels2[a][b][d]=0;
-                //cout<<"show now"<<" "<<pixels[i][j][c]<<"\n";
-                for(int t=0; t<8; t++)
-                {
-                    pixels2[a][b][d]+=(binary[t]*pow(2,(7-t)));
-                }
-
-                d++;
-            }
-            if(ok)
-                break;
-        }
-        if(ok)
-            break;
-    }
+        sha512Update(hash,data,size);
+    });
 
-    int countOfBits=binaryToDecimal(tempBin,32);
-   // cout<<countOfBits<<" size \n";
-    //cout<<"a b d"<<a<<b<<" "<<d<<"\n";
+    sha512Final(hash,result.digest);
+    result.payloadBytes=binaryStream.bytes.size();
 
-   // cout<<"show "<<countOfBits<<"\n";
-    if(countOfBits<=0 or countOfBits>((height*width*3)-32))
-        cout<<"No message is hidden in this image\n\n";
+    /** the length has to fit the 32 bit header **/
+    result.fits=binaryStream.bitCount<=INT_MAX and binaryStream.bitCount+32<=result.capacity;
 
-    else{
-    /** retrieving data **/
-    bool cnt=true;
-    ok=false;
-    p=0;
-    vector<int>binaryValue;
-    int octet=0;
-    countOfBits/=8;
-    int decimalValueArray[countOfBits]={0};
-    int track=0;
-    vector<char>storeCharacter;
-    countOfBits*=8;
+    if(!result.fits)
+    {
+        return result;
+    }
 
+    BitStream flagStreams=decimalToBinary(binaryStream.bitCount);
 
-    for(int i=a; i<height; i++)
+    result.stegoImage=writeStegoImage(imageFile,flagStreams,binaryStream,1,threadCount);
+
+    return result;
+}
+string hidingFile(string imageFile,string payloadFile,int depth,int threadCount,string key,bool embedDigest)
+{
+    /** any file, byte for byte, behind a payload record holding its name
+        and its 64 bit length. with a key the record also gets the mac.
+    **/
+    struct stat info;
+    if(depth<1 or depth>maximumDepth or stat(payloadFile.c_str(),&info)!=0)
     {
-        for(int j=b; j<width; j++)
-        {
-            if(cnt==true and d!=0)
-            {
-                c=d;
-                cnt=false;
-            }
-            else
-            {
-                c=0;
-            }
-            while(c<3)
-            {
-                if(p==countOfBits)
-                {
-                    ok=true;
-                    break;
-                }
-
-                int quotient=pixels2[i][j][c];
-              //  cout<<"#extracting "<<quotient<<" ";
-                int remainder;
-                int binary[8];
-                int k=7;
-                while(quotient)
-                {
-                    remainder=quotient%2;
-                    binary[k]=remainder;
-                    k--;
-                    quotient/=2;
-                }
-
-                while(k>=0)
-                {
-                    binary[k]=0;
-                    k--;
-                }
-
-                binaryValue.push_back(binary[7]);
-                p++;
-                octet++;
-
-                /** keep the stego image as it is **/
-                pixels2[i][j][c]=0;
-
-                for(int t=0; t<8; t++)
-                {
-                    pixels2[i][j][c]+=(binary[t]*pow(2,(7-t)));
-                }
-
-                if(octet==8)
-                {
-                    octet=0;
-                    /*for(int t=0;t<binaryValue.size();t++)
-                    {
-                        cout<<binaryValue[t]<<" ";
-                    }
-                    puts("");*/
-
-                    for(int t=0; t<8; t++)
-                    {
-                        decimalValueArray[track]+=(binaryValue[t]*pow(2,(7-t)));
-                    }
-
-                    //cout<<decimalValueArray[track]<<" value\n";
-                    char ch=decimalValueArray[track];
-                    storeCharacter.push_back(ch);
-                    track++;
-                    binaryValue.clear();
-                }
-                //cout<<" vector size "<<binaryValue.size()<<"\n";
-                c++;
-            }
-            if(ok)
-                break;
-        }
-        if(ok)
-            break;
+        return " ";
     }
 
-    string hiddenMessage;
+    struct PayloadRecord record;
+    record.payloadType=payloadBinary;
+    record.fileName=payloadBaseName(payloadFile);
+    record.depth=depth;
+    record.payloadLength=info.st_size;
 
-    for(int i=0; i<storeCharacter.size(); i++)
+    if(record.fileName.size()>0xffff)
     {
-        hiddenMessage+=storeCharacter[i];
+        return " ";
     }
 
-    puts("The hidden message : ");
+    bool authenticated=!key.empty();
+    HMACSHA512Context mac;
+    SHA512Context hash;
 
-    cout<<hiddenMessage<<"\n";
-    cout<<"\n\n";
+    /** the flags are part of what the mac covers, so they are set first **/
+    if(embedDigest)
+    {
+        record.flags|=payloadDigestFlag;
+        sha512Init(hash);
+    }
 
-    //h m in a new text file
-    std::ofstream outputFile("hidden_msg.txt");
-    if (outputFile.is_open()) {
-        outputFile << hiddenMessage;
-        outputFile.close();
-        std::cout << "Hidden message saved in hidden_msg.txt\n";
-    } else {
-        std::cerr << "Error opening hidden_msg.txt for writing.\n";
-          // Return an error code to indicate failure
+    if(authenticated)
+    {
+        record.flags|=payloadMacFlag;
+        payloadMacStart(mac,record,key);
     }
 
+    /** the mac and the digest take in every chunk as it is read, the file
+        is read once
+    **/
+    BitStream binaryStream=fileToBinary(payloadFile,[&](const unsigned char *data,size_t size)
+    {
+        if(authenticated)
+        {
+            hmacSha512Update(mac,data,size);
+        }
+        if(embedDigest)
+        {
+            sha512Update(hash,data,size);
+        }
+    });
 
+    if(binaryStream.bitCount!=8LL*info.st_size)
+    {
+        return " ";
+    }
 
+    if(embedDigest)
+    {
+        sha512Final(hash,record.digest);
     }
-    
+    if(authenticated)
+    {
+        if(embedDigest)
+        {
+            hmacSha512Update(mac,record.digest,payloadDigestSize);
+        }
+        hmacSha512Final(mac,record.mac);
+    }
+
+    /** at depth 3 the last carrier can reach past the last payload byte **/
+    binaryStream.bytes.push_back(0);
+
+    return writeStegoImage(imageFile,payloadHeader(record),binaryStream,depth,threadCount);
 }
-vector<int> decimalToBinary(int decimalValue)
+BitStream payloadHeader(const PayloadRecord &record)
 {
-  //  cout<<decimalValue<<"\n";
-    int storeBianry[32];
-    int k=31;
-    int remainder;
+    BitStream result;
+    vector<unsigned char> &bytes=result.bytes;
 
-    while(decimalValue)
+    for(int shift=24; shift>=0; shift-=8)
     {
-        remainder=decimalValue%2;
-        storeBianry[k]=remainder;
-        decimalValue/=2;
-        k--;
+        bytes.push_back((payloadMagic>>shift)&0xff);
     }
 
-    while(k>=0)
+    bytes.push_back(record.version);
+    bytes.push_back((record.flags&~payloadDepthMask)|(record.depth-1));
+    bytes.push_back(record.payloadType);
+    bytes.push_back((record.fileName.size()>>8)&0xff);
+    bytes.push_back(record.fileName.size()&0xff);
+
+    for(int shift=56; shift>=0; shift-=8)
     {
-        storeBianry[k]=0;
-        k--;
+        bytes.push_back((record.payloadLength>>shift)&0xff);
     }
 
-    /*for(int i=0;i<32;i++)
-        cout<<storeBianry[i]<<" ";
-        puts("");*/
+    if(record.flags&payloadMacFlag)
+    {
+        bytes.insert(bytes.end(),record.mac,record.mac+payloadMacSize);
+    }
 
-    vector<int>result;
+    if(record.flags&payloadDigestFlag)
+    {
+        bytes.insert(bytes.end(),record.digest,record.digest+payloadDigestSize);
+    }
 
-    for(int i=0;i<32;i++)
-        result.push_back(storeBianry[i]);
+    bytes.insert(bytes.end(),record.fileName.begin(),record.fileName.end());
+    result.bitCount=8LL*bytes.size();
 
     return result;
 }
-int binaryToDecimal(int binArray[],int length)
+int parsePayloadRecord(const unsigned char *bytes,PayloadRecord &record,int &nameLength)
 {
-    int decimalValue=0;
+    /** bytes holds the payloadRecordSize bytes in front of the name **/
+    unsigned int magic=(bytes[0]<<24)|(bytes[1]<<16)|(bytes[2]<<8)|bytes[3];
+
+    if(magic!=payloadMagic or bytes[4]!=payloadVersion)
+    {
+        return 0;
+    }
 
-   /* for(int i=0;i<length;i++)
-        cout<<binArray[i]<<" ";*/
+    record.version=bytes[4];
+    record.flags=bytes[5];
+    record.depth=(bytes[5]&payloadDepthMask)+1;
+    record.payloadType=bytes[6];
+    nameLength=(bytes[7]<<8)|bytes[8];
 
-    for(int t=0; t<length; t++)
+    record.payloadLength=0;
+    for(int i=9; i<17; i++)
     {
-        if(binArray[t])
-            decimalValue+=(binArray[t]*pow(2,(31-t)));
+        record.payloadLength=(record.payloadLength<<8)|bytes[i];
     }
 
-    return decimalValue;
+    return 1;
 }
-void openingImage(string fileName){
+void payloadMacStart(HMACSHA512Context &mac,const PayloadRecord &record,string key)
+{
+    /** the mac covers the record as embedded, less the mac itself **/
+    BitStream header=payloadHeader(record);
+    const unsigned char *bytes=header.bytes.data();
 
-// Replace "path/to/animated.gif" with the actual path to the animated GIF file.
-     string file_path = "C:\\Users\\HP\\Desktop\\test\\";
+    hmacSha512Init(mac,(const unsigned char *)key.data(),key.size());
+    hmacSha512Update(mac,bytes,payloadRecordSize);
+    hmacSha512Update(mac,bytes+header.bytes.size()-record.fileName.size(),record.fileName.size());
+}
+string payloadBaseName(string path)
+{
+    /** only the last path component is stored and restored **/
+    size_t slash=path.find_last_of("/\\");
+    if(slash!=string::npos)
+    {
+        path=path.substr(slash+1);
+    }
+
+    return path;
+}
+int readCarriers(int fd,long long offset,const CarrierLayout &layout,long long carrier,long long count,unsigned char *bits,long long bitPos,int threadCount,int depth)
+{
+    /** preads exactly the pixels holding the given carriers, offset is
+        where the pixel array starts in the file
+    **/
+    if(count<=0)
+    {
+        return 1;
+    }
+
+    long long runLeft;
+    long long firstChannel=carrierChannel(layout,carrier,runLeft);
+    long long lastChannel=carrierChannel(layout,carrier+count-1,runLeft);
+    long long base=firstChannel-firstChannel%3;
+
+    vector<unsigned char> window(lastChannel-lastChannel%3+3-base);
+
+    if(!readPixelRange(fd,offset+base,window))
+    {
+        return 0;
+    }
+
+    forEachBand(carrier,count,bitPos,depth,threadCount,[&](long long first,long long n,long long position)
+    {
+        extractCarriers(window.data(),base,layout,first,n,bits,position,depth);
+    });
+
+    return 1;
+}
+void extractingData(string imageFile,int threadCount,string key)
+{
+    ExtractResult result=extractingDataAndVerify(imageFile,NULL,threadCount,key);
+
+    if(result.verdict==verifyMatch)
+    {
+        cout<<"the extracted data matches the digest hidden with it\n";
+    }
+    else if(result.verdict==verifyMismatch)
+    {
+        cout<<"the extracted data does not match the digest hidden with it\n";
+    }
+}
+ExtractResult extractingDataAndVerify(string imageFile,const unsigned char *expected,int threadCount,string key)
+{
+    /** only the header and the carriers that hold the message are read:
+        first the 32 length carriers, then exactly the byte range of the
+        payload carriers. the payload is hashed as it comes out and the
+        digest is checked against expected, or against the digest hidden
+        in the header, without reading anything back.
+    **/
+    ExtractResult result;
+    struct Image image;
+
+    ifstream inputFile;
+    inputFile.open(imageFile.c_str(),ios::binary);
+
+    long long fileSize;
+    if(!inputFile or !loadImageHeader(inputFile,image,fileSize))
+    {
+        cout<<"couldn't read the image file\n\n";
+        return result;
+    }
+
+    inputFile.close();
+
+    int fd=open(imageFile.c_str(),O_RDONLY);
+    if(fd<0)
+    {
+        cout<<"couldn't read the image file\n\n";
+        return result;
+    }
+
+    long long offset=image.header.size();
+
+
+    /** reading the lsb of each carrier byte **/
+    struct CarrierLayout layout=carrierLayout(image.height,image.width);
+
+    unsigned char lengthBits[4];
+
+    if(layout.capacity<32 or !readCarriers(fd,offset,layout,0,32,lengthBits,0,1))
+    {
+        close(fd);
+        cout<<"No message is hidden in this image\n\n";
+        return result;
+    }
+
+    int countOfBits=(lengthBits[0]<<24)|(lengthBits[1]<<16)|(lengthBits[2]<<8)|lengthBits[3];
+   // cout<<countOfBits<<" size \n";
+
+    /** a file hidden by hidingFile starts with the payload magic instead **/
+    if((unsigned int)countOfBits==payloadMagic)
+    {
+        extractingFile(fd,offset,layout,threadCount,key,expected,result);
+        close(fd);
+        return result;
+    }
+
+    if(countOfBits<=0 or countOfBits>layout.capacity-32)
+    {
+        close(fd);
+        cout<<"No message is hidden in this image\n\n";
+        return result;
+    }
+
+    if(!key.empty())
+    {
+        cout<<"this message carries no mac, it can not be authenticated\n\n";
+    }
+
+    /** retrieving data **/
+    int countOfBytes=countOfBits/8;
+    vector<unsigned char>storeCharacter(countOfBytes);
+
+    int ok=readCarriers(fd,offset,layout,32,8LL*countOfBytes,storeCharacter.data(),0,threadCount);
+    close(fd);
+
+    if(!ok)
+    {
+        cout<<"couldn't read the image file\n\n";
+        return result;
+    }
+
+    SHA512Context hash;
+    sha512Init(hash);
+    sha512Update(hash,storeCharacter.data(),storeCharacter.size());
+    sha512Final(hash,result.digest);
+
+    result.found=true;
+    result.payloadBytes=countOfBytes;
+
+    if(expected)
+    {
+        result.verdict=digestsEqual(result.digest,expected) ? verifyMatch : verifyMismatch;
+    }
+
+    string hiddenMessage(storeCharacter.begin(),storeCharacter.end());
+
+    puts("The hidden message : ");
+
+    cout<<hiddenMessage<<"\n";
+    cout<<"\n\n";
+
+    //h m in a new text file
+    std::ofstream outputFile("hidden_msg.txt");
+    if (outputFile.is_open()) {
+        outputFile << hiddenMessage;
+        outputFile.close();
+        result.outputFile="hidden_msg.txt";
+        std::cout << "Hidden message saved in hidden_msg.txt\n";
+    } else {
+        std::cerr << "Error opening hidden_msg.txt for writing.\n";
+          // Return an error code to indicate failure
+    }
+
+    return result;
+}
+void extractingFile(int fd,long long offset,const CarrierLayout &layout,int threadCount,string key,const unsigned char *expected,ExtractResult &result)
+{
+    /** reads the payload record, then copies the payload out a slice at a
+        time, so the memory used does not grow with the payload
+    **/
+    unsigned char recordBytes[payloadRecordSize];
+    struct PayloadRecord record;
+    int nameLength;
+
+    if(layout.capacity<8LL*payloadRecordSize or
+       !readCarriers(fd,offset,layout,0,8LL*payloadRecordSize,recordBytes,0,1) or
+       !parsePayloadRecord(recordBytes,record,nameLength))
+    {
+        cout<<"No message is hidden in this image\n\n";
+        return;
+    }
+
+    bool authenticated=record.flags&payloadMacFlag;
+    bool digested=record.flags&payloadDigestFlag;
+    long long macCarriers=authenticated ? 8LL*payloadMacSize : 0;
+    long long digestCarriers=digested ? 8LL*payloadDigestSize : 0;
+    long long headerCarriers=8LL*payloadHeaderSize(record.flags,nameLength);
+
+    if(authenticated and key.empty())
+    {
+        cout<<"this file is authenticated, the key is needed to extract it\n\n";
+        return;
+    }
+
+    if(!authenticated and !key.empty())
+    {
+        cout<<"this file carries no mac, it can not be authenticated\n\n";
+    }
+
+    if(headerCarriers>layout.capacity or record.payloadLength>(unsigned long long)(layout.capacity-headerCarriers)*record.depth/8)
+    {
+        cout<<"No message is hidden in this image\n\n";
+        return;
+    }
+
+    vector<unsigned char> name(nameLength);
+    if(!readCarriers(fd,offset,layout,8LL*payloadRecordSize,macCarriers,record.mac,0,1) or
+       !readCarriers(fd,offset,layout,8LL*payloadRecordSize+macCarriers,digestCarriers,record.digest,0,1) or
+       !readCarriers(fd,offset,layout,8LL*payloadRecordSize+macCarriers+digestCarriers,8LL*nameLength,name.data(),0,1))
+    {
+        cout<<"couldn't read the image file\n\n";
+        return;
+    }
+
+    record.fileName=string(name.begin(),name.end());
+
+    /** the mac and the hash take in every slice as it is read, both are
+        checked after the last
+    **/
+    HMACSHA512Context mac;
+    if(authenticated)
+    {
+        payloadMacStart(mac,record,key);
+    }
+
+    SHA512Context hash;
+    sha512Init(hash);
+
+    record.fileName=payloadBaseName(record.fileName);
+
+    string outputName="hidden_msg.txt";
+    if(record.payloadType!=payloadText)
+    {
+        outputName=record.fileName.empty() ? "hidden_payload.bin" : "hidden_"+record.fileName;
+    }
+
+    /** the payload goes to a temporary file next to the output, which only
+        replaces it once the mac has passed, so an image that fails never
+        touches a file already there
+    **/
+    string tempName=outputName+".XXXXXX";
+    int tempFd=mkstemp(&tempName[0]);
+    if(tempFd>=0)
+    {
+        close(tempFd);
+    }
+
+    ofstream outputFile(tempName.c_str(),ios::binary);
+    if(tempFd<0 or !outputFile)
+    {
+        std::cerr << "Error opening " << outputName << " for writing.\n";
+        if(tempFd>=0)
+        {
+            remove(tempName.c_str());
+        }
+        return;
+    }
+
+    if(record.payloadType==payloadText)
+    {
+        puts("The hidden message : ");
+    }
+
+    /** a slice is a whole number of carriers at every depth, the spare
+        byte takes the bits a depth 3 carrier holds past the payload end
+    **/
+    const long long slice=12<<16;
+    long long length=record.payloadLength;
+    vector<unsigned char> buffer(min(slice,length)+1);
+    long long carrier=headerCarriers;
+
+    for(long long done=0; done<length; )
+    {
+        long long n=min(slice,length-done);
+
+        long long count=depthCarriers(8*n,record.depth);
+
+        if(!readCarriers(fd,offset,layout,carrier,count,buffer.data(),0,threadCount,record.depth))
+        {
+            cout<<"couldn't read the image file\n\n";
+            outputFile.close();
+            remove(tempName.c_str());
+            return;
+        }
+
+        if(authenticated)
+        {
+            hmacSha512Update(mac,buffer.data(),n);
+        }
+        sha512Update(hash,buffer.data(),n);
+
+        outputFile.write((const char *)buffer.data(),n);
+        if(record.payloadType==payloadText)
+        {
+            cout.write((const char *)buffer.data(),n);
+        }
+
+        carrier+=count;
+        done+=n;
+    }
+
+    if(record.payloadType==payloadText)
+    {
+        cout<<"\n\n\n";
+    }
+
+    outputFile.close();
+
+    if(!outputFile)
+    {
+        std::cerr << "Error writing " << outputName << ".\n";
+        remove(tempName.c_str());
+        return;
+    }
+
+    if(authenticated)
+    {
+        unsigned char expected[64];
+        if(digested)
+        {
+            hmacSha512Update(mac,record.digest,payloadDigestSize);
+        }
+        hmacSha512Final(mac,expected);
+
+        /** a file that fails the check is not left behind **/
+        if(!digestsEqual(expected,record.mac))
+        {
+            remove(tempName.c_str());
+            cout<<"authentication failed, the hidden file was changed or the key is wrong\n\n";
+            return;
+        }
+
+        cout<<"the hidden file is authentic\n";
+    }
+
+    if(rename(tempName.c_str(),outputName.c_str())!=0)
+    {
+        std::cerr << "Error writing " << outputName << ".\n";
+        remove(tempName.c_str());
+        return;
+    }
+
+    sha512Final(hash,result.digest);
+
+    result.found=true;
+    result.outputFile=outputName;
+    result.payloadBytes=length;
+
+    /** the digest hidden with the file is the one it was made from, a
+        digest given by the caller is only used when there is none
+    **/
+    const unsigned char *reference=digested ? record.digest : expected;
+    if(reference)
+    {
+        result.verdict=digestsEqual(result.digest,reference) ? verifyMatch : verifyMismatch;
+    }
+
+    std::cout << "Hidden file saved in " << outputName << "\n";
+}
+int readPixelRange(int fd,long long offset,vector<unsigned char> &buffer)
+{
+    /** fills buffer from the given file offset, pread may return less than asked **/
+    long long done=0;
+
+    while(done<(long long)buffer.size())
+    {
+        ssize_t n=pread(fd,buffer.data()+done,buffer.size()-done,offset+done);
+        if(n<=0)
+        {
+            return 0;
+        }
+        done+=n;
+    }
+
+    return 1;
+}
+string writeStegoImageStreaming(string imageFile,const BitStream &header,const BitStream &payload,int depth)
+{
+    /** gives the same stego image as writeStegoImage while holding only one
+        scanline of the image in memory, whatever the image size
+    **/
+    struct Image image;
+    string outputImage=stegoImageName(imageFile);
+
+    ifstream inputFile;
+    inputFile.open(imageFile.c_str(),ios::binary);
+
+    long long fileSize;
+    if(!inputFile or !loadImageHeader(inputFile,image,fileSize))
+    {
+        return " ";
+    }
+
+    long long headerCarriers=header.bitCount;
+    long long payloadCarriers=depthCarriers(payload.bitCount,depth);
+
+    struct CarrierLayout layout=carrierLayout(image.height,image.width);
+
+    if(payloadCarriers+headerCarriers>layout.capacity)
+    {
+        return " ";
+    }
+
+    const unsigned char *headerBits=header.bytes.data();
+    const unsigned char *dataBits=payload.bytes.data();
+
+    ofstream outputFile;
+    outputFile.open(outputImage.c_str(),ios::binary);
+
+    if(!outputFile)
+    {
+        return " ";
+    }
+
+    outputFile.write((const char *)image.header.data(),image.header.size());
+
+    /** the window is one scanline plus up to 2 bytes of a pixel cut off at
+        the end of the previous scanline, so window[0] always starts a pixel
+    **/
+    vector<unsigned char> window(image.rowStride+2);
+    long long windowStart=0;
+    long long kept=0;
+    long long carriers=headerCarriers+payloadCarriers;
+
+    for(int row=0; row<image.width; row++)
+    {
+        inputFile.read((char *)window.data()+kept,image.rowStride);
+
+        long long size=kept+image.rowStride;
+        long long whole=size-size%3;
+
+        long long first=carrierAtChannel(layout,windowStart);
+        long long last=min(carriers,carrierAtChannel(layout,windowStart+whole));
+
+        /** header bits first, then data bits **/
+        long long dataFirst=max(first,headerCarriers);
+        embedCarriers(window.data(),windowStart,layout,first,min(last,headerCarriers)-first,headerBits,first);
+        embedCarriers(window.data(),windowStart,layout,dataFirst,last-dataFirst,dataBits,(dataFirst-headerCarriers)*depth,depth);
+
+        outputFile.write((const char *)window.data(),whole);
+
+        kept=size-whole;
+        memmove(window.data(),window.data()+whole,kept);
+        windowStart+=whole;
+    }
+
+    outputFile.write((const char *)window.data(),kept);
+
+    /** anything stored after the pixel array **/
+    vector<char> buffer(1<<16);
+    while(inputFile.read(buffer.data(),buffer.size()) or inputFile.gcount()>0)
+    {
+        outputFile.write(buffer.data(),inputFile.gcount());
+    }
+
+    if(!outputFile)
+    {
+        return " ";
+    }
+
+    outputFile.close();
+
+    return outputImage;
+}
+int copyImageFile(string sourceFile,string targetFile)
+{
+    /** reflink when the file system can share extents, otherwise let the
+        kernel copy with copy_file_range, otherwise copy through a buffer
+    **/
+    int source=open(sourceFile.c_str(),O_RDONLY);
+    if(source<0)
+    {
+        return 0;
+    }
+
+    int target=open(targetFile.c_str(),O_WRONLY|O_CREAT|O_TRUNC,0644);
+    if(target<0)
+    {
+        close(source);
+        return 0;
+    }
+
+    struct stat info;
+    fstat(source,&info);
+    long long left=info.st_size;
+
+#ifdef FICLONE
+    if(ioctl(target,FICLONE,source)==0)
+    {
+        left=0;
+    }
+#endif
+
+    while(left>0)
+    {
+        ssize_t n=copy_file_range(source,NULL,target,NULL,left,0);
+        if(n<=0)
+        {
+            break;
+        }
+        left-=n;
+    }
+
+    vector<char> buffer(1<<20);
+    while(left>0)
+    {
+        ssize_t n=read(source,buffer.data(),buffer.size());
+        if(n<=0 or write(target,buffer.data(),n)!=n)
+        {
+            break;
+        }
+        left-=n;
+    }
+
+    close(source);
+    if(close(target)!=0)
+    {
+        return 0;
+    }
+
+    return left==0;
+}
+string writeStegoImageInPlace(string imageFile,const BitStream &header,const BitStream &payload,int depth,int threadCount)
+{
+    /** copies the image and then writes the payload into the copy through
+        mmap. only the pages holding carriers that take a payload bit are
+        touched, so the cost follows the payload size, not the image size.
+    **/
+    struct Image image;
+    string outputImage=stegoImageName(imageFile);
+
+    ifstream inputFile;
+    inputFile.open(imageFile.c_str(),ios::binary);
+
+    long long fileSize;
+    if(!inputFile or !loadImageHeader(inputFile,image,fileSize))
+    {
+        return " ";
+    }
+
+    inputFile.close();
+
+    long long headerCarriers=header.bitCount;
+    long long payloadCarriers=depthCarriers(payload.bitCount,depth);
+
+    struct CarrierLayout layout=carrierLayout(image.height,image.width);
+
+    if(payloadCarriers+headerCarriers>layout.capacity)
+    {
+        return " ";
+    }
+
+    const unsigned char *headerBits=header.bytes.data();
+    const unsigned char *dataBits=payload.bytes.data();
+
+    if(!copyImageFile(imageFile,outputImage))
+    {
+        return " ";
+    }
+
+    /** map up to the pixel holding the last payload carrier **/
+    long long runLeft;
+    long long lastChannel=carrierChannel(layout,headerCarriers+payloadCarriers-1,runLeft);
+    size_t mappedSize=image.header.size()+lastChannel-lastChannel%3+3;
+
+    int fd=open(outputImage.c_str(),O_RDWR);
+    if(fd<0)
+    {
+        return " ";
+    }
+
+    void *mapped=mmap(NULL,mappedSize,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+
+    if(mapped==MAP_FAILED)
+    {
+        return " ";
+    }
+
+    unsigned char *pixels=(unsigned char *)mapped+image.header.size();
+
+    /** at first embedding the header, then the data **/
+    embedCarriers(pixels,0,layout,0,headerCarriers,headerBits,0);
+    forEachBand(headerCarriers,payloadCarriers,0,depth,threadCount,[&](long long carrier,long long count,long long bitPos)
+    {
+        embedCarriers(pixels,0,layout,carrier,count,dataBits,bitPos,depth);
+    });
+
+    if(munmap(mapped,mappedSize)!=0)
+    {
+        return " ";
+    }
+
+    return outputImage;
+}
+BitStream decimalToBinary(int decimalValue)
+{
+    /** the 32 bit length header, most significant bit first **/
+    BitStream result;
+    result.bitCount=32;
+
+    for(int shift=24; shift>=0; shift-=8)
+    {
+        result.bytes.push_back((decimalValue>>shift)&0xff);
+    }
+
+    return result;
+}
+void openingImage(string fileName){
+
+// Replace "path/to/animated.gif" with the actual path to the animated GIF file.
+     string file_path = "C:\\Users\\HP\\Desktop\\test\\";
 
     // Build the command to open the file with the Windows Photos app.
     string command = "start " + file_path+fileName;
@@ -747,66 +1506,49 @@ void processInputText(string textFile)
     fclose(fp);
 
 }
-vector<int> textToBinary(string textFile)
+BitStream textToBinary(string textFile)
 {
-    /** file opening **/
-    FILE *fp1=fopen(textFile.c_str(),"r");
-
-    /** checking text file size **/
-    long long int textFileSize;
+    return fileToBinary(textFile);
+}
+BitStream fileToBinary(string payloadFile,function<void(const unsigned char *,size_t)> consume)
+{
+    /** the file bytes already are the payload bits, msb first, so the file
+        is read straight into the stream and used as it is. consume sees
+        every chunk as it arrives, so a hash can be taken in the same pass.
+    **/
+    BitStream bits;
 
-    string text;
-    int countCharacter=0;
-    char ch;
-    while((ch=fgetc(fp1)!=EOF))
+    FILE *fp1=fopen(payloadFile.c_str(),"rb");
+    if(fp1==NULL)
     {
-       countCharacter++;
+        return bits;
     }
 
-    textFileSize=countCharacter*8;
-
-    /*cout<<"text file size in bits"<<"\n";
-    cout<<"size: "<<textFileSize<<"\n";
-    cout<<"total character: "<<countCharacter<<"\n";*/
-
-
-    /** section of conversion **/
+    fseek(fp1,0,SEEK_END);
+    long long textFileSize=ftell(fp1);
     rewind(fp1);
-   // cout<<ftell(fp)<<"\n";
-    int decimal=0;
-    int index=0;
-    int quotient;
-    int remainder;
-    int i;
-    vector<int>bits;
-
-    while((ch=fgetc(fp1))!=EOF)
-    {
-        decimal=ch;
-        quotient=decimal;
-        i=7;
-        int tempArray[8];
-
-        while(quotient)
-        {
-            remainder=quotient%2;
-            tempArray[i]=remainder;
-            i--;
-            quotient/=2;
-        }
 
-        while(i>=0)
+    bits.bytes.resize(textFileSize);
+
+    const long long chunk=1<<20;
+    for(long long done=0; done<textFileSize; done+=chunk)
+    {
+        size_t n=min(chunk,textFileSize-done);
+        if(fread(bits.bytes.data()+done,1,n,fp1)!=n)
         {
-            tempArray[i]=0;
-            i--;
+            bits.bytes.clear();
+            break;
         }
 
-       //cout<<ch<<" ";
-        for(int t=0;t<8;t++)
+        if(consume)
         {
-            bits.push_back(tempArray[t]);
+            consume(bits.bytes.data()+done,n);
         }
     }
 
+    fclose(fp1);
+
+    bits.bitCount=8LL*bits.bytes.size();
+
     return bits;
 }
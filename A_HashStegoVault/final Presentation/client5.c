@@ -2,8 +2,20 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
 #include <arpa/inet.h>
-#define SIZE 1024
+#include "sha512.h"
+#include "transfer.h"
+#define SIZE (1 << 20)
+#define PROGRESS_STEP (16 << 20)  // Bytes between two progress lines
+#define HASH_GROUP 64                // Files hashed together, at most
+#define HASH_GROUP_BYTES (64 << 20)  // and at most about this many bytes of them
 
 char* addImageFileExtension(const char* imageFileName) {
     // Calculate the length of the new string
@@ -27,37 +39,407 @@ char* addImageFileExtension(const char* imageFileName) {
     return newFileName;
 }
 
-void send_file(FILE *fp, int sockfd) {
-  char data[SIZE];
-  size_t bytesRead;
+// send may take only part of what it is given
+void send_all(int sockfd, const void *data, size_t size) {
+  size_t sent = 0;
 
-  while ((bytesRead = fread(data, 1, sizeof(data), fp)) > 0) {
-    if (send(sockfd, data, bytesRead, 0) == -1) {
+  while (sent < size) {
+    ssize_t n = send(sockfd, (const char *)data + sent, size - sent, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
       perror("[-]Error in sending file.");
       exit(1);
     }
-    bzero(data, SIZE);
+    sent += n;
   }
 }
 
+// Only files of at least PROGRESS_STEP bytes show their progress
+void show_progress(off_t sent, off_t size) {
+  if (size < PROGRESS_STEP)
+    return;
 
-int main(){
+  printf("\r[+]Sent %lld of %lld bytes (%d%%)", (long long)sent, (long long)size,
+         size ? (int)(100 * sent / size) : 100);
+  fflush(stdout);
+}
+
+// Leaves of a file too large to hash in a group, one per chunk, hashed
+// on several threads. root gets the tree root the header carries.
+unsigned char *hash_chunks(const char *path, off_t size, unsigned char root[64]) {
+  unsigned long long chunks = transfer_chunks(size);
+  unsigned char *leaves = malloc(64 * chunks);
+
+  if (leaves == NULL) {
+    perror("Memory allocation failed");
+    exit(EXIT_FAILURE);
+  }
+  if (!sha512_tree_file(path, TRANSFER_CHUNK_SIZE, chunks, leaves, root)) {
+    fprintf(stderr, "[-]Error in reading file.\n");
+    exit(1);
+  }
+  return leaves;
+}
+
+// Frame header for the file: its size, content type, name and SHA-512,
+// the tree root for a chunked file, so the server knows what comes
+// before the first payload byte
+void send_header(int sockfd, const char *filename, off_t size, const unsigned char digest[64]) {
+  struct transfer_header header;
+  unsigned char frame[TRANSFER_HEADER_SIZE];
+
+  const char *name = strrchr(filename, '/');
+  name = name ? name + 1 : filename;
+
+  if (strlen(name) > TRANSFER_MAX_NAME) {
+    fprintf(stderr, "[-]The file name is too long to send.\n");
+    exit(1);
+  }
+
+  header.version = TRANSFER_VERSION;
+  header.type = transfer_type_of(name) | (transfer_chunked(size) ? TRANSFER_CHUNKED : 0);
+  header.name_length = strlen(name);
+  header.length = size;
+  memcpy(header.digest, digest, 64);
+  transfer_encode(&header, frame);
+
+  send_all(sockfd, frame, sizeof(frame));
+  send_all(sockfd, name, header.name_length);
+}
+
+// Fallback for when sendfile can't be used: the file from offset to end
+// through one large buffer
+void send_file_copy(int fd, int sockfd, off_t offset, off_t end, off_t size) {
+  char *data = malloc(SIZE);
+  ssize_t bytesRead;
+
+  if (data == NULL || lseek(fd, offset, SEEK_SET) < 0) {
+    perror("[-]Error in reading file.");
+    exit(1);
+  }
+
+  while (offset < end && (bytesRead = read(fd, data, end - offset < SIZE ? end - offset : SIZE)) > 0) {
+    send_all(sockfd, data, bytesRead);
+    offset += bytesRead;
+    show_progress(offset, size);
+  }
+
+  if (offset < end) {
+    perror("[-]Error in reading file.");
+    exit(1);
+  }
+  free(data);
+}
+
+// The kernel copies the file straight to the socket, nothing passes
+// through this process. Exactly the bytes from offset to end go out,
+// the ones the header promised.
+void send_file(int fd, int sockfd, off_t offset, off_t end, off_t size) {
+  while (offset < end) {
+    off_t step = end - offset < PROGRESS_STEP ? end - offset : PROGRESS_STEP;
+    ssize_t n = sendfile(sockfd, fd, &offset, step);
+    if (n > 0) {
+      show_progress(offset, size);
+      continue;
+    }
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+      send_file_copy(fd, sockfd, offset, end, size);
+      break;
+    }
+    if (n == 0)
+      fprintf(stderr, "\n[-]The file got shorter while it was sent.\n");
+    else
+      perror("[-]Error in sending file.");
+    exit(1);
+  }
+}
+
+// The files to send over one connection, in order
+struct batch {
+  char **names;
+  size_t count;
+  size_t capacity;
+};
+
+void add_file(struct batch *files, const char *path) {
+  struct stat info;
+
+  if (stat(path, &info) < 0 || !S_ISREG(info.st_mode) || access(path, R_OK) < 0) {
+    fprintf(stderr, "[-]Skipping %s, not a readable file.\n", path);
+    return;
+  }
+
+  if (files->count == files->capacity) {
+    files->capacity = files->capacity ? 2 * files->capacity : 64;
+    files->names = realloc(files->names, files->capacity * sizeof(char *));
+    if (files->names == NULL) {
+      perror("Memory allocation failed");
+      exit(EXIT_FAILURE);
+    }
+  }
+  files->names[files->count++] = strdup(path);
+}
+
+// Every regular file directly in the directory, in name order
+void add_directory(struct batch *files, const char *path) {
+  struct dirent **entries;
+  int n = scandir(path, &entries, NULL, alphasort);
+
+  if (n < 0) {
+    perror("[-]Error in reading directory");
+    return;
+  }
+
+  for (int i = 0; i < n; i++) {
+    if (entries[i]->d_name[0] != '.') {
+      char full[4096];
+      snprintf(full, sizeof(full), "%s/%s", path, entries[i]->d_name);
+      add_file(files, full);
+    }
+    free(entries[i]);
+  }
+  free(entries);
+}
+
+// One path per line, empty lines are skipped
+void add_manifest(struct batch *files, const char *path) {
+  FILE *manifest = fopen(path, "r");
+  char line[4096];
+
+  if (manifest == NULL) {
+    perror("[-]Error in reading manifest");
+    return;
+  }
+
+  while (fgets(line, sizeof(line), manifest)) {
+    line[strcspn(line, "\r\n")] = 0;
+    if (line[0] != '\0')
+      add_file(files, line);
+  }
+  fclose(manifest);
+}
+
+// Hash the files that are not chunked from first on, several at once,
+// until HASH_GROUP of them or HASH_GROUP_BYTES are taken. Gives the
+// index after the last file looked at.
+size_t hash_files(struct batch *files, size_t first, unsigned char *digests) {
+  const char *paths[HASH_GROUP];
+  size_t owners[HASH_GROUP];
+  unsigned char group[HASH_GROUP * 64];
+  size_t count = 0;
+  off_t bytes = 0;
+  size_t i;
+
+  for (i = first; i < files->count && count < HASH_GROUP && bytes < HASH_GROUP_BYTES; i++) {
+    struct stat info;
+    if (stat(files->names[i], &info) < 0) {
+      perror("[-]Error in reading file.");
+      exit(1);
+    }
+    if (transfer_chunked(info.st_size))
+      continue;
+
+    paths[count] = files->names[i];
+    owners[count++] = i;
+    bytes += info.st_size;
+  }
+
+  if (count > 0 && !sha512_files(paths, count, group)) {
+    fprintf(stderr, "[-]Error in reading file.\n");
+    exit(1);
+  }
+  for (size_t j = 0; j < count; j++)
+    memcpy(digests + 64 * owners[j], group + 64 * j, 64);
+
+  return i;
+}
+
+// The server acknowledges the files in the order they were sent, so
+// acknowledgement i is about file i. Runs beside the sender, which never
+// waits for an answer before sending the next file, except for the map
+// of a chunked file, handed over through map and map_ready.
+struct acks {
+  int sockfd;
+  struct batch *files;
+  size_t received;
+  size_t stored;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  unsigned char *map;
+  unsigned long long map_chunks;
+  int map_ready;
+  int done;  // The server has closed its side
+};
+
+int recv_all(int sockfd, void *data, size_t size) {
+  size_t have = 0;
+
+  while (have < size) {
+    ssize_t n = recv(sockfd, (char *)data + have, size - have, 0);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return 0;
+    have += n;
+  }
+  return 1;
+}
+
+// Take in one answer, 0 when there are no more
+int read_answer(struct acks *acks) {
+  unsigned char answer[TRANSFER_ACK_SIZE];
+
+  if (!recv_all(acks->sockfd, answer, 4))
+    return 0;
+
+  if (transfer_get(answer, 4) == TRANSFER_HAVE_MAGIC) {
+    if (!recv_all(acks->sockfd, answer + 4, TRANSFER_HAVE_SIZE - 4))
+      return 0;
+
+    unsigned long long chunks = transfer_get(answer + 4, 8);
+    unsigned char *map = malloc(chunks / 8 + 1);
+    if (map == NULL || !recv_all(acks->sockfd, map, (chunks + 7) / 8)) {
+      free(map);
+      return 0;
+    }
+
+    pthread_mutex_lock(&acks->lock);
+    acks->map = map;
+    acks->map_chunks = chunks;
+    acks->map_ready = 1;
+    pthread_cond_signal(&acks->changed);
+    pthread_mutex_unlock(&acks->lock);
+    return 1;
+  }
+
+  int status;
+  unsigned long long stored;
+  if (!recv_all(acks->sockfd, answer + 4, TRANSFER_ACK_SIZE - 4)
+      || !transfer_decode_ack(answer, &status, &stored) || acks->received >= acks->files->count) {
+    fprintf(stderr, "[-]The server sent something that is not an acknowledgement.\n");
+    return 0;
+  }
+
+  const char *name = acks->files->names[acks->received];
+  if (status != TRANSFER_STORED)
+    fprintf(stderr, "[-]%s was rejected: %s.\n", name, transfer_status_text(status));
+
+  pthread_mutex_lock(&acks->lock);
+  acks->received++;
+  acks->stored += status == TRANSFER_STORED;
+  pthread_cond_signal(&acks->changed);
+  pthread_mutex_unlock(&acks->lock);
+  return 1;
+}
+
+void *read_acks(void *arg) {
+  struct acks *acks = arg;
+
+  while (read_answer(acks))
+    ;
+
+  pthread_mutex_lock(&acks->lock);
+  acks->done = 1;
+  pthread_cond_signal(&acks->changed);
+  pthread_mutex_unlock(&acks->lock);
+  return NULL;
+}
+
+// Wait for the map of chunked file i. NULL when the server answered
+// with a rejection instead.
+unsigned char *wait_for_map(struct acks *acks, size_t i) {
+  unsigned char *map = NULL;
+
+  pthread_mutex_lock(&acks->lock);
+  while (!acks->map_ready && acks->received <= i && !acks->done)
+    pthread_cond_wait(&acks->changed, &acks->lock);
+
+  if (acks->map_ready) {
+    map = acks->map;
+    acks->map_ready = 0;
+  } else if (acks->received <= i) {
+    fprintf(stderr, "[-]The connection closed before the server answered.\n");
+    exit(1);
+  }
+  pthread_mutex_unlock(&acks->lock);
+
+  return map;
+}
+
+// Send the chunks the map says are missing, each behind its index and
+// its leaf, hashed before the header went out, so sendfile takes the
+// chunk straight from the page cache to the socket.
+void send_chunks(int fd, int sockfd, off_t size, const unsigned char *map, const unsigned char *leaves) {
+  unsigned long long chunks = transfer_chunks(size);
+  unsigned char header[TRANSFER_CHUNK_HEADER_SIZE];
+  unsigned long long already = 0;
+
+  for (unsigned long long i = 0; i < chunks; i++)
+    already += transfer_has_chunk(map, i);
+  if (already > 0)
+    printf("[+]Resuming, %llu of %llu chunks are already on the server.\n", already, chunks);
+
+  for (unsigned long long i = 0; i < chunks; i++) {
+    off_t offset = i * TRANSFER_CHUNK_SIZE;
+    off_t end = size - offset < (off_t)TRANSFER_CHUNK_SIZE ? size : offset + (off_t)TRANSFER_CHUNK_SIZE;
+
+    if (transfer_has_chunk(map, i))
+      continue;
+
+    transfer_put(header, i, 8);
+    memcpy(header + 8, leaves + 64 * i, 64);
+    send_all(sockfd, header, sizeof(header));
+    send_file(fd, sockfd, offset, end, size);
+  }
+
+  if (size >= PROGRESS_STEP)
+    printf("\n");
+}
+
+// With no arguments the client asks for one image, as before. Otherwise
+// every file, directory (its files) and @manifest (the files it lists)
+// named on the command line goes over one connection.
+int main(int argc, char *argv[]){
   char *ip = "127.0.0.1";
   int port = 8080;
   int e;
 
   int sockfd;
   struct sockaddr_in server_addr;
-  FILE *fp;
+  int fd;
   char filename[256];
+  struct batch files = { NULL, 0, 0 };
 
-  printf("Enter the file name: ");
-  fgets(filename, sizeof(filename), stdin);
-  filename[strcspn(filename, "\n")] = 0;  // Remove newline character
-  char* newFileName = addImageFileExtension(filename);
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      struct stat info;
+      if (argv[i][0] == '@')
+        add_manifest(&files, argv[i] + 1);
+      else if (stat(argv[i], &info) == 0 && S_ISDIR(info.st_mode))
+        add_directory(&files, argv[i]);
+      else
+        add_file(&files, argv[i]);
+    }
+  } else {
+    printf("Enter the file name: ");
+    fgets(filename, sizeof(filename), stdin);
+    filename[strcspn(filename, "\n")] = 0;  // Remove newline character
+    char* newFileName = addImageFileExtension(filename);
     strcpy(filename, newFileName);
 
-  printf("\nfile name is %s\n",filename);
+    printf("\nfile name is %s\n",filename);
+    add_file(&files, filename);
+  }
+
+  if (files.count == 0) {
+    fprintf(stderr, "[-]No files to send.\n");
+    exit(1);
+  }
+  signal(SIGPIPE, SIG_IGN);
+
   sockfd = socket(AF_INET, SOCK_STREAM, 0);
   if(sockfd < 0) {
     perror("[-]Error in socket");
@@ -76,18 +458,69 @@ int main(){
   }
 	printf("[+]Connected to Server.\n");
 
-  fp = fopen(filename, "rb");
-  if (fp == NULL) {
-    perror("[-]Error in reading file.");
+  struct acks acks = { sockfd, &files, 0, 0, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, 0, 0, 0 };
+  pthread_t reader;
+  if (pthread_create(&reader, NULL, read_acks, &acks) != 0) {
+    perror("[-]Error in starting the reader");
     exit(1);
   }
 
-  send_file(fp, sockfd);
+  // Whole files are hashed a group at a time, ahead of being sent, and
+  // chunked files get the root of their tree
+  unsigned char *digests = malloc(64 * files.count);
+  size_t hashed = 0;
+  if (digests == NULL) {
+    perror("Memory allocation failed");
+    exit(EXIT_FAILURE);
+  }
+
+  for (size_t i = 0; i < files.count; i++) {
+    struct stat info;
+    fd = open(files.names[i], O_RDONLY);
+    if (fd < 0 || fstat(fd, &info) < 0) {
+      perror("[-]Error in reading file.");
+      exit(1);
+    }
+
+    off_t size = info.st_size;
+    unsigned char *leaves = NULL;
+    if (transfer_chunked(size))
+      leaves = hash_chunks(files.names[i], size, digests + 64 * i);
+    else if (i >= hashed)
+      hashed = hash_files(&files, i, digests);
+
+    send_header(sockfd, files.names[i], size, digests + 64 * i);
+    if (transfer_chunked(size)) {
+      unsigned char *map = wait_for_map(&acks, i);
+      if (map != NULL && acks.map_chunks == transfer_chunks(size))
+        send_chunks(fd, sockfd, size, map, leaves);
+      else if (map != NULL) {
+        fprintf(stderr, "[-]The server sent a map for another file.\n");
+        exit(1);
+      }
+      free(map);
+      free(leaves);
+    } else {
+      send_file(fd, sockfd, 0, size, size);
+      if (size >= PROGRESS_STEP)
+        printf("\n");
+    }
+    close(fd);
+  }
   printf("[+]File data sent successfully.\n");
 
+  // No more files, the answers to the last ones are still on their way
+  shutdown(sockfd, SHUT_WR);
+  pthread_join(reader, NULL);
+  printf("[+]%zu of %zu files stored.\n", acks.stored, files.count);
+
 	printf("[+]Closing the connection.\n");
   close(sockfd);
-  
 
-  return 0;
+  for (size_t i = 0; i < files.count; i++)
+    free(files.names[i]);
+  free(files.names);
+  free(digests);
+
+  return acks.stored == files.count ? 0 : 1;
 }
@@ -0,0 +1,323 @@
+#include<bits/stdc++.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include<immintrin.h>
+#define LSB_KERNEL_X86 1
+#endif
+
+using namespace std;
+
+/** lsb embedding kernels.
+    a run of carriers is given as consecutive channels of the pixel array.
+    channels are counted r,g,b while the file stores b,g,r, so channel c
+    lives at byte 3*(c/3)+2-c%3. payload bits are taken msb first, starting
+    at bit bitPos of bits.
+**/
+
+typedef void (*EmbedKernel)(unsigned char *pixels,long long first,long long count,const unsigned char *bits,long long bitPos);
+typedef void (*ExtractKernel)(const unsigned char *pixels,long long first,long long count,unsigned char *bits,long long bitPos);
+
+inline void embedBit(unsigned char &carrier,int bit)
+{
+    carrier=(carrier&~1)|bit;
+}
+inline int extractBit(unsigned char carrier)
+{
+    return carrier&1;
+}
+inline long long channelByte(long long channel)
+{
+    return channel-channel%3+2-channel%3;
+}
+
+/** scalar reference, every other kernel has to produce the same bytes **/
+void embedChannelsScalar(unsigned char *pixels,long long first,long long count,const unsigned char *bits,long long bitPos)
+{
+    for(long long i=0; i<count; i++)
+    {
+        long long p=bitPos+i;
+        embedBit(pixels[channelByte(first+i)],(bits[p>>3]>>(7-(p&7)))&1);
+    }
+}
+void extractChannelsScalar(const unsigned char *pixels,long long first,long long count,unsigned char *bits,long long bitPos)
+{
+    for(long long i=0; i<count; i++)
+    {
+        long long p=bitPos+i;
+        unsigned char mask=0x80>>(p&7);
+
+        if(extractBit(pixels[channelByte(first+i)]))
+            bits[p>>3]|=mask;
+        else
+            bits[p>>3]&=~mask;
+    }
+}
+
+/** k lsbs per carrier for a depth k of 2 to 4. the first of the k payload
+    bits goes to the highest of them, so a carrier reads msb first like the
+    payload. bitPos advances by depth bits per carrier.
+**/
+void embedChannelsDepth(unsigned char *pixels,long long first,long long count,const unsigned char *bits,long long bitPos,int depth)
+{
+    unsigned int mask=(1<<depth)-1;
+
+    for(long long i=0; i<count; i++)
+    {
+        long long p=bitPos+i*depth;
+        unsigned int word=bits[p>>3]<<8;
+        if((p&7)+depth>8)
+            word|=bits[(p>>3)+1];
+
+        unsigned char &carrier=pixels[channelByte(first+i)];
+        carrier=(carrier&~mask)|((word>>(16-(p&7)-depth))&mask);
+    }
+}
+void extractChannelsDepth(const unsigned char *pixels,long long first,long long count,unsigned char *bits,long long bitPos,int depth)
+{
+    for(long long i=0; i<count; i++)
+    {
+        unsigned char carrier=pixels[channelByte(first+i)];
+
+        for(int j=0; j<depth; j++)
+        {
+            long long p=bitPos+i*depth+j;
+            unsigned char mask=0x80>>(p&7);
+
+            if((carrier>>(depth-1-j))&1)
+                bits[p>>3]|=mask;
+            else
+                bits[p>>3]&=~mask;
+        }
+    }
+}
+
+/** the vector kernels work on blocks of 16 pixels, 48 carriers holding
+    6 whole payload bytes. blockHead is the number of carriers to do one
+    by one before a run starts on a pixel and on a payload byte at once.
+**/
+inline long long blockHead(long long first,long long bitPos)
+{
+    long long head=0;
+    while((first+head)%3!=0 or (bitPos+head)%8!=0)
+        head++;
+    return head;
+}
+inline unsigned long long loadBlockBits(const unsigned char *bytes)
+{
+    unsigned long long word=0;
+    for(int i=0; i<6; i++)
+        word=(word<<8)|bytes[i];
+    return word;
+}
+inline void storeBlockBits(unsigned char *bytes,unsigned long long word)
+{
+    for(int i=5; i>=0; i--)
+    {
+        bytes[i]=word&0xff;
+        word>>=8;
+    }
+}
+/** bit 47 is the first carrier of the block. swapping the red and blue
+    bit of every pixel turns channel order into file byte order and back.
+**/
+inline unsigned long long swapPixelChannels(unsigned long long word)
+{
+    return ((word&0x924924924924ULL)>>2)|((word&0x249249249249ULL)<<2)|(word&0x492492492492ULL);
+}
+inline unsigned char reverseByte(unsigned int b)
+{
+    b=((b&0xf0)>>4)|((b&0x0f)<<4);
+    b=((b&0xcc)>>2)|((b&0x33)<<2);
+    b=((b&0xaa)>>1)|((b&0x55)<<1);
+    return b;
+}
+
+#ifdef LSB_KERNEL_X86
+__attribute__((target("sse2")))
+void embedChannelsSSE2(unsigned char *pixels,long long first,long long count,const unsigned char *bits,long long bitPos)
+{
+    long long head=min(count,blockHead(first,bitPos));
+    embedChannelsScalar(pixels,first,head,bits,bitPos);
+    first+=head;
+    bitPos+=head;
+    count-=head;
+
+    const __m128i bitMask=_mm_set1_epi64x(0x0102040810204080LL);
+    const __m128i lsbClear=_mm_set1_epi8((char)0xfe);
+    const __m128i one=_mm_set1_epi8(1);
+
+    while(count>=48)
+    {
+        unsigned char fileBits[6];
+        storeBlockBits(fileBits,swapPixelChannels(loadBlockBits(bits+(bitPos>>3))));
+
+        unsigned char *block=pixels+first;
+        for(int k=0; k<3; k++)
+        {
+            /** spread two payload bytes over 16 lanes, one bit per lane **/
+            __m128i v=_mm_cvtsi32_si128(fileBits[2*k]|(fileBits[2*k+1]<<8));
+            v=_mm_unpacklo_epi8(v,v);
+            v=_mm_unpacklo_epi16(v,v);
+            v=_mm_unpacklo_epi32(v,v);
+            v=_mm_cmpeq_epi8(_mm_and_si128(v,bitMask),bitMask);
+
+            __m128i carriers=_mm_loadu_si128((const __m128i *)(block+16*k));
+            carriers=_mm_or_si128(_mm_and_si128(carriers,lsbClear),_mm_and_si128(v,one));
+            _mm_storeu_si128((__m128i *)(block+16*k),carriers);
+        }
+
+        first+=48;
+        bitPos+=48;
+        count-=48;
+    }
+
+    embedChannelsScalar(pixels,first,count,bits,bitPos);
+}
+__attribute__((target("sse2")))
+void extractChannelsSSE2(const unsigned char *pixels,long long first,long long count,unsigned char *bits,long long bitPos)
+{
+    long long head=min(count,blockHead(first,bitPos));
+    extractChannelsScalar(pixels,first,head,bits,bitPos);
+    first+=head;
+    bitPos+=head;
+    count-=head;
+
+    while(count>=48)
+    {
+        unsigned char fileBits[6];
+
+        const unsigned char *block=pixels+first;
+        for(int k=0; k<3; k++)
+        {
+            __m128i carriers=_mm_loadu_si128((const __m128i *)(block+16*k));
+            int mask=_mm_movemask_epi8(_mm_slli_epi64(carriers,7));
+            fileBits[2*k]=reverseByte(mask&0xff);
+            fileBits[2*k+1]=reverseByte((mask>>8)&0xff);
+        }
+
+        storeBlockBits(bits+(bitPos>>3),swapPixelChannels(loadBlockBits(fileBits)));
+
+        first+=48;
+        bitPos+=48;
+        count-=48;
+    }
+
+    extractChannelsScalar(pixels,first,count,bits,bitPos);
+}
+__attribute__((target("avx2")))
+void embedChannelsAVX2(unsigned char *pixels,long long first,long long count,const unsigned char *bits,long long bitPos)
+{
+    long long head=min(count,blockHead(first,bitPos));
+    embedChannelsScalar(pixels,first,head,bits,bitPos);
+    first+=head;
+    bitPos+=head;
+    count-=head;
+
+    const __m256i spread=_mm256_setr_epi8(0,0,0,0,0,0,0,0,1,1,1,1,1,1,1,1,
+                                          2,2,2,2,2,2,2,2,3,3,3,3,3,3,3,3);
+    const __m256i bitMask=_mm256_set1_epi64x(0x0102040810204080LL);
+    const __m256i lsbClear=_mm256_set1_epi8((char)0xfe);
+    const __m256i one=_mm256_set1_epi8(1);
+
+    /** two blocks per step, 32 carriers per vector **/
+    while(count>=96)
+    {
+        unsigned char fileBits[12];
+        storeBlockBits(fileBits,swapPixelChannels(loadBlockBits(bits+(bitPos>>3))));
+        storeBlockBits(fileBits+6,swapPixelChannels(loadBlockBits(bits+(bitPos>>3)+6)));
+
+        unsigned char *block=pixels+first;
+        for(int k=0; k<3; k++)
+        {
+            int four;
+            memcpy(&four,fileBits+4*k,4);
+
+            __m256i v=_mm256_shuffle_epi8(_mm256_set1_epi32(four),spread);
+            v=_mm256_cmpeq_epi8(_mm256_and_si256(v,bitMask),bitMask);
+
+            __m256i carriers=_mm256_loadu_si256((const __m256i *)(block+32*k));
+            carriers=_mm256_or_si256(_mm256_and_si256(carriers,lsbClear),_mm256_and_si256(v,one));
+            _mm256_storeu_si256((__m256i *)(block+32*k),carriers);
+        }
+
+        first+=96;
+        bitPos+=96;
+        count-=96;
+    }
+
+    embedChannelsSSE2(pixels,first,count,bits,bitPos);
+}
+__attribute__((target("avx2")))
+void extractChannelsAVX2(const unsigned char *pixels,long long first,long long count,unsigned char *bits,long long bitPos)
+{
+    long long head=min(count,blockHead(first,bitPos));
+    extractChannelsScalar(pixels,first,head,bits,bitPos);
+    first+=head;
+    bitPos+=head;
+    count-=head;
+
+    /** reversing every 8 bytes makes movemask hand back msb first bytes **/
+    const __m256i reverse=_mm256_setr_epi8(7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+                                           7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+
+    while(count>=96)
+    {
+        unsigned char fileBits[12];
+
+        const unsigned char *block=pixels+first;
+        for(int k=0; k<3; k++)
+        {
+            __m256i carriers=_mm256_loadu_si256((const __m256i *)(block+32*k));
+            carriers=_mm256_shuffle_epi8(carriers,reverse);
+            unsigned int mask=_mm256_movemask_epi8(_mm256_slli_epi64(carriers,7));
+            memcpy(fileBits+4*k,&mask,4);
+        }
+
+        storeBlockBits(bits+(bitPos>>3),swapPixelChannels(loadBlockBits(fileBits)));
+        storeBlockBits(bits+(bitPos>>3)+6,swapPixelChannels(loadBlockBits(fileBits+6)));
+
+        first+=96;
+        bitPos+=96;
+        count-=96;
+    }
+
+    extractChannelsSSE2(pixels,first,count,bits,bitPos);
+}
+#endif
+
+/** picks the widest kernel the cpu reports through cpuid **/
+string lsbKernelName()
+{
+#ifdef LSB_KERNEL_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return "avx2";
+    if(__builtin_cpu_supports("sse2"))
+        return "sse2";
+#endif
+    return "scalar";
+}
+EmbedKernel selectEmbedKernel()
+{
+#ifdef LSB_KERNEL_X86
+    string name=lsbKernelName();
+    if(name=="avx2")
+        return embedChannelsAVX2;
+    if(name=="sse2")
+        return embedChannelsSSE2;
+#endif
+    return embedChannelsScalar;
+}
+ExtractKernel selectExtractKernel()
+{
+#ifdef LSB_KERNEL_X86
+    string name=lsbKernelName();
+    if(name=="avx2")
+        return extractChannelsAVX2;
+    if(name=="sse2")
+        return extractChannelsSSE2;
+#endif
+    return extractChannelsScalar;
+}
+
+EmbedKernel embedChannels=selectEmbedKernel();
+ExtractKernel extractChannels=selectExtractKernel();
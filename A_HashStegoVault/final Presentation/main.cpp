@@ -6,10 +6,10 @@
 #include <time.h>
 #include <thread>
 #include <sstream>
+#include "lsbKernel.cpp"
+#include "sha512.cpp"
 #include "Steganography.cpp"
 #include "serverRun.cpp"
-#include "hash_checking.cpp"
-#include "sha512.cpp"
 
 int main()
 {
@@ -22,6 +22,7 @@ int main()
              << "What do you want to do ?" << endl;
         cout << "1.Data Hiding," << endl;
         cout << "2.Data Extracting" << endl;
+        cout << "3.File Hiding" << endl;
         cout << "0.Exit" << endl;
 
         int choice;
@@ -78,6 +79,8 @@ int main()
                 continue;
             }
 
+            inputfile1.close();
+
             if (!checkingTextFile(extendedImageFileName, extendedTextFileName))
             {
                 cout << "not possible to hide the text file within provided image file.";
@@ -85,19 +88,28 @@ int main()
                 continue;
             }
 
-            inputfile1.close();
-
             cout << "Do you want to create a hash of your input ? 1.Yes, 2.No" << endl
                  << ":";
             int h;
             cin >> h;
+
+            /** the input is read once, for the hash and the embedding **/
+            HideResult hidden = hidingDataAndHash(extendedImageFileName, extendedTextFileName);
+
+            if (!hidden.fits)
+            {
+                cout << "not possible to hide the text file within provided image file.";
+                cout << "redirecting to the option menu.\n\n";
+                continue;
+            }
+
             if (h == 1)
             {
-                string hashResult = generateSHA512Hash("input.txt", "hashOfInput.txt");
+                saveSHA512Hash(hidden.digest, "hashOfInput.txt");
             }
 
-            string stegoImage;
-            if ((stegoImage = hidingData(extendedImageFileName, extendedTextFileName)) != " ")
+            string stegoImage = hidden.stegoImage;
+            if (stegoImage != " ")
             {
                 puts("stego image is ready");
                 cout << "\n\n";
@@ -175,15 +187,31 @@ int main()
                 continue;
             }
 
-            extractingData(extendedStegoImageFileName);
+            cout << "provide the key the file was hidden with, or - for none";
+            cout << "\n";
+
+            string key;
+            cin >> key;
+            if (key == "-")
+            {
+                key = "";
+            }
+
+            /** the message is hashed and checked against the saved hash of
+                the input while it comes out, nothing is read back
+            **/
+            unsigned char expected[64];
+            bool haveExpected = loadSHA512Hash("hashOfInput.txt", expected);
+
+            ExtractResult extracted = extractingDataAndVerify(extendedStegoImageFileName, haveExpected ? expected : NULL, 0, key);
             int h;
 
             cout << "Do you want to generate hash of the message? 1.Yes, 2.No " << endl
                  << ":";
             cin >> h;
-            if (h == 1)
+            if (h == 1 && extracted.found)
             {
-                string hashResult = generateSHA512Hash("hidden_msg.txt", "hashOfOutput.txt");
+                saveSHA512Hash(extracted.digest, "hashOfOutput.txt");
             }
 
             cout << "Do you want to check you message correctness ? 1.Yes, 2.No" << endl
@@ -192,18 +220,99 @@ int main()
             cin >> c;
             if (c == 1)
             {
-                if (compareFiles("hashOfInput.txt", "hashOfOutput.txt"))
+                if (extracted.verdict == verifyMatch)
                 {
                     std::cout << "Both files have the same content." << std::endl;
                 }
-                else
+                else if (extracted.verdict == verifyMismatch)
                 {
                     std::cout << "The contents of the files are different." << std::endl;
                 }
+                else
+                {
+                    std::cout << "There is no hash of the input to check against." << std::endl;
+                }
             }
 
             continueLoop = false;
         }
+        else if (choice == 3)
+        {
+            string imageFileName;
+            string payloadFileName;
+
+            cout << "provide image file name";
+            cout << "\n";
+
+            cin >> imageFileName;
+            string extendedImageFileName = addImageFileExtension(imageFileName);
+
+            cout << "provide the file to hide";
+            cout << "\n";
+
+            cin >> payloadFileName;
+
+            cout << "bits per channel (1-4), more bits hide more but show more";
+            cout << "\n";
+
+            int depth;
+            cin >> depth;
+
+            ifstream inputFile;
+            inputFile.open(extendedImageFileName, ios::binary);
+
+            if (!inputFile)
+            {
+                cout << "couldn't find the image file in storage\n";
+                cout << "redirecting to the option menu\n\n";
+                continue;
+            }
+
+            inputFile.close();
+
+            if (!checkingImageFormat(extendedImageFileName))
+            {
+                cout << "sorry, the image format is not correct.\n";
+                cout << "redirecting to the option menu.\n\n";
+                continue;
+            }
+
+            if (!checkingPayloadFile(extendedImageFileName, payloadFileName, depth, payloadDigestFlag))
+            {
+                cout << "not possible to hide the file within provided image file at this depth.";
+                cout << "redirecting to the option menu.\n\n";
+                continue;
+            }
+
+            cout << "provide a key to authenticate the file, or - for none";
+            cout << "\n";
+
+            string key;
+            cin >> key;
+            if (key == "-")
+            {
+                key = "";
+            }
+
+            /** the mac takes another 64 bytes of the image **/
+            if (!key.empty() && !checkingPayloadFile(extendedImageFileName, payloadFileName, depth, payloadDigestFlag | payloadMacFlag))
+            {
+                cout << "not possible to hide the file and its mac within provided image file at this depth.";
+                cout << "redirecting to the option menu.\n\n";
+                continue;
+            }
+
+            if (hidingFile(extendedImageFileName, payloadFileName, depth, 0, key, true) != " ")
+            {
+                puts("stego image is ready");
+                cout << "\n\n";
+            }
+            else
+            {
+                puts("failed to create stego image");
+                continue;
+            }
+        }
         else if (choice == 0)
         {
             continueLoop = false;
@@ -1,80 +1,1217 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
-#define SIZE 1024
+#include "sha512.h"
+#include "transfer.h"
+#define SIZE 65536
+#define MAX_EVENTS 64
+#define MAX_WORKERS 64
+#define MAX_CLIENTS 256  // Per worker, the listening socket is dropped while a worker is full
+#define PIPE_SIZE (1 << 20)
+#define ACK_QUEUE 256  // Acknowledgements a sender can leave unread before reading stops
+#define OUT_LIMIT (ACK_QUEUE * TRANSFER_ACK_SIZE)
+#define SWEEP_INTERVAL 3600  // Seconds between two looks for abandoned resume files
+#define WAKEUP_BUDGET (1 << 20)  // Bytes read from a connection before the others get a turn
 
-void write_file(int sockfd) {
-    int n;
-    FILE *fp;
-    char *filename = "recv.bmp";  // Change the filename to the appropriate extension
-    unsigned char buffer[SIZE];
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE (1u << 28)
+#endif
 
-    fp = fopen(filename, "wb"); // Open file in binary mode
-    if (fp == NULL) {
+enum stage {
+    READING_HEADER,
+    READING_NAME,
+    READING_BODY,
+    SKIPPING_BODY,  // The file was rejected, its payload is read and dropped
+    READING_CHUNK_HEADER,
+    READING_CHUNK
+};
+
+// One connection: the socket, where it is in the current frame, the
+// temporary file the payload is written to (fd is -1 between files) and
+// the answers not sent yet
+struct connection {
+    int sockfd;
+    int fd;
+    char temp[128];
+    int stage;
+    unsigned char header[TRANSFER_HEADER_SIZE + TRANSFER_MAX_NAME + 1];
+    size_t have;
+    struct transfer_header frame;
+    unsigned long long received;
+    unsigned char *out;
+    size_t out_have;
+    size_t out_capacity;
+    // A chunked file: the map of verified chunks, on disk and in memory,
+    // the chunks this sender still has to send and the one coming in
+    char map[128];
+    int mapfd;
+    int created;  // This connection created the resume files
+    unsigned char *chunk_map;
+    unsigned char *leaves;  // Leaf of each verified chunk, after the map on disk
+    unsigned long long chunks;
+    unsigned long long verified;
+    unsigned long long missing;
+    unsigned char chunk_header[TRANSFER_CHUNK_HEADER_SIZE];
+    size_t chunk_have;
+    unsigned long long chunk;
+    unsigned long long chunk_length;
+    unsigned long long chunk_received;
+    void *hash;           // SHA-512 of the payload or chunk coming in
+    unsigned int events;  // What epoll watches the socket for
+    int closing;          // The sender is done, only acknowledgements are left
+    long long budget;     // Bytes it may still read before the worker moves on
+    struct connection *prev, *next;
+};
+
+// Each worker runs its own epoll loop, the listening socket is in all of
+// them with EPOLLEXCLUSIVE so one connection wakes one worker
+struct worker {
+    pthread_t thread;
+    int epfd;
+    int clients;
+    int listening;
+    struct connection *open;  // Uploads in progress, dropped if the server stops
+    int pipefd[2];            // Carries spliced data from a socket to a file, -1 without splice
+    int teefd[2];             // Gets a copy of what is in pipefd, for the hash
+    size_t pipe_size;         // Bytes both pipes hold
+};
+
+int listen_sock;
+int once = 0;
+unsigned long long max_size = 0;  // 0 takes any size
+long resume_age = 7 * 24 * 3600;  // Resume files untouched this long are removed, 0 keeps them
+volatile sig_atomic_t stop = 0;
+unsigned int sequence = 0;
+
+void handle_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+// Move a finished upload to recv_<time>_<n>_<name>. link fails instead
+// of replacing an existing file, so two uploads never end up in one name.
+int store_file(struct connection *conn, char *filename, size_t size) {
+    const char *name = (const char *)conn->header + TRANSFER_HEADER_SIZE;
+
+    while (1) {
+        unsigned int n = __sync_fetch_and_add(&sequence, 1);
+        snprintf(filename, size, "recv_%lld_%u_%s", (long long)time(NULL), n, name);
+
+        if (link(conn->temp, filename) == 0) {
+            unlink(conn->temp);
+            return 0;
+        }
+        if (errno != EEXIST) {
+            perror("[-]Error in storing file.");
+            unlink(conn->temp);
+            return -1;
+        }
+    }
+}
+
+// Drop a file that was not received whole. A chunked file is only
+// closed, its verified chunks wait for the sender to come back. Resume
+// files this connection created and put no verified chunk in go, while
+// the lock is still held.
+void discard_file(struct connection *conn) {
+    if (conn->fd >= 0) {
+        if (conn->mapfd < 0) {
+            unlink(conn->temp);
+        } else if (conn->created && conn->verified == 0) {
+            unlink(conn->temp);
+            unlink(conn->map);
+        }
+        close(conn->fd);
+        conn->fd = -1;
+    }
+
+    if (conn->mapfd >= 0) {
+        close(conn->mapfd);
+        conn->mapfd = -1;
+    }
+    free(conn->chunk_map);
+    conn->chunk_map = NULL;
+    free(conn->leaves);
+    conn->leaves = NULL;
+
+    if (conn->hash) {
+        unsigned char digest[64];
+        sha512_end(conn->hash, digest);
+        conn->hash = NULL;
+    }
+}
+
+void close_connection(struct worker *w, struct connection *conn) {
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, conn->sockfd, NULL);
+    close(conn->sockfd);
+    discard_file(conn);
+    free(conn->out);
+
+    // --once serves a single sender, with all the files it sends
+    if (once) {
+        stop = 1;
+    }
+
+    if (conn->prev) {
+        conn->prev->next = conn->next;
+    } else {
+        w->open = conn->next;
+    }
+    if (conn->next) {
+        conn->next->prev = conn->prev;
+    }
+    free(conn);
+    w->clients--;
+
+    // Room again, take new connections
+    if (!w->listening && w->clients < MAX_CLIENTS) {
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, listen_sock, &ev) == 0) {
+            w->listening = 1;
+        }
+    }
+}
+
+void accept_connections(struct worker *w) {
+    while (w->clients < MAX_CLIENTS) {
+        int sockfd = accept4(listen_sock, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sockfd < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                perror("[-]Error in accepting connection");
+            }
+            return;
+        }
+
+        struct connection *conn = malloc(sizeof(struct connection));
+        if (conn == NULL) {
+            close(sockfd);
+            continue;
+        }
+        conn->sockfd = sockfd;
+        conn->fd = -1;
+        conn->stage = READING_HEADER;
+        conn->have = 0;
+        conn->out = NULL;
+        conn->out_have = 0;
+        conn->out_capacity = 0;
+        conn->mapfd = -1;
+        conn->created = 0;
+        conn->chunk_map = NULL;
+        conn->leaves = NULL;
+        conn->hash = NULL;
+        conn->events = EPOLLIN | EPOLLRDHUP;
+        conn->closing = 0;
+
+        struct epoll_event ev = { .events = conn->events, .data.ptr = conn };
+        if (epoll_ctl(w->epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+            perror("[-]Error in epoll");
+            close(sockfd);
+            free(conn);
+            continue;
+        }
+        conn->prev = NULL;
+        conn->next = w->open;
+        if (w->open) {
+            w->open->prev = conn;
+        }
+        w->open = conn;
+        w->clients++;
+    }
+
+    // Full, leave the connections waiting in the backlog to other workers
+    epoll_ctl(w->epfd, EPOLL_CTL_DEL, listen_sock, NULL);
+    w->listening = 0;
+}
+
+// Keep the base name of what the sender calls the file, anything but
+// letters, digits, '.', '-' and '_' becomes '_'. 0 if nothing is left.
+int clean_name(char *name) {
+    char *base = strrchr(name, '/');
+    base = base ? base + 1 : name;
+    memmove(name, base, strlen(base) + 1);
+
+    for (char *c = name; *c; c++) {
+        if (!(*c >= 'a' && *c <= 'z') && !(*c >= 'A' && *c <= 'Z')
+            && !(*c >= '0' && *c <= '9') && *c != '.' && *c != '-') {
+            *c = '_';
+        }
+    }
+    return name[0] != '\0' && strcmp(name, ".") != 0 && strcmp(name, "..") != 0;
+}
+
+// A chunked file is kept under a name made from its tree root and
+// length, next to the map of its verified chunks and their leaves, so a
+// sender that lost the connection finds both again. One sender at a time
+// holds the lock.
+int open_resume_file(struct connection *conn) {
+    char key[64];
+    const char *name = (const char *)conn->header + TRANSFER_HEADER_SIZE;
+
+    for (int i = 0; i < 16; i++) {
+        sprintf(key + 2 * i, "%02x", conn->frame.digest[i]);
+    }
+    snprintf(conn->temp, sizeof(conn->temp), "resume_%s_%llu.part", key, conn->frame.length);
+    snprintf(conn->map, sizeof(conn->map), "resume_%s_%llu.map", key, conn->frame.length);
+
+    while (1) {
+        conn->created = 1;
+        conn->fd = open(conn->temp, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+        if (conn->fd < 0 && errno == EEXIST) {
+            conn->created = 0;
+            conn->fd = open(conn->temp, O_RDWR | O_CLOEXEC);
+        }
+        if (conn->fd < 0) {
+            perror("[-]Error in opening file.");
+            return TRANSFER_FAILED;
+        }
+        if (flock(conn->fd, LOCK_EX | LOCK_NB) < 0) {
+            fprintf(stderr, "[-]Rejected %s, another sender is sending it.\n", name);
+            close(conn->fd);
+            conn->fd = -1;
+            return TRANSFER_BUSY;
+        }
+
+        // The sweep may have removed the file between open and flock
+        struct stat held, named;
+        if (fstat(conn->fd, &held) == 0 && stat(conn->temp, &named) == 0 && held.st_ino == named.st_ino) {
+            break;
+        }
+        close(conn->fd);
+    }
+
+    conn->mapfd = open(conn->map, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    conn->chunks = transfer_chunks(conn->frame.length);
+    conn->chunk_map = calloc(conn->chunks / 8 + 1, 1);
+    conn->leaves = calloc(conn->chunks, 64);
+    conn->verified = 0;
+
+    // A map left by an interrupted transfer tells what can be kept, a
+    // new one reads back short and leaves every chunk missing. A map
+    // without its file is stale.
+    if (conn->mapfd < 0 || conn->chunk_map == NULL || conn->leaves == NULL
+        || (conn->created && ftruncate(conn->mapfd, 0) < 0)
+        || pread(conn->mapfd, conn->chunk_map, (conn->chunks + 7) / 8, 0) < 0
+        || pread(conn->mapfd, conn->leaves, 64 * conn->chunks, (conn->chunks + 7) / 8) < 0) {
         perror("[-]Error in opening file.");
-        exit(1);
+        // Nothing is known of the chunks in a file that was already
+        // there, it stays
+        if (conn->created) {
+            unlink(conn->temp);
+            unlink(conn->map);
+        }
+        if (conn->mapfd >= 0) {
+            close(conn->mapfd);
+            conn->mapfd = -1;
+        }
+        close(conn->fd);
+        conn->fd = -1;
+        free(conn->chunk_map);
+        conn->chunk_map = NULL;
+        free(conn->leaves);
+        conn->leaves = NULL;
+        return TRANSFER_FAILED;
+    }
+
+    for (unsigned long long i = 0; i < conn->chunks; i++) {
+        conn->verified += transfer_has_chunk(conn->chunk_map, i);
+    }
+    conn->missing = conn->chunks - conn->verified;
+
+    if (conn->frame.length > 0 && fallocate(conn->fd, 0, 0, conn->frame.length) < 0
+        && errno != EOPNOTSUPP && errno != ENOSYS) {
+        fprintf(stderr, "[-]Rejected %s, no room for %llu bytes: %s\n", name, conn->frame.length, strerror(errno));
+        discard_file(conn);
+        return TRANSFER_NO_ROOM;
+    }
+
+    if (conn->verified > 0) {
+        printf("[+]Resuming %s, %llu of %llu chunks are already here.\n", name,
+               conn->verified, conn->chunks);
+        fflush(stdout);
+    }
+
+    return TRANSFER_STORED;
+}
+
+// Remove resume files no sender has come back to for resume_age
+// seconds. A file some worker holds the lock on is in use and stays.
+void sweep_resume_files(void) {
+    DIR *dir = opendir(".");
+    struct dirent *entry;
+    time_t now = time(NULL);
+
+    if (dir == NULL) {
+        perror("[-]Error in reading directory");
+        return;
     }
 
+    while ((entry = readdir(dir)) != NULL) {
+        char map[256];
+        struct stat info;
+        size_t length = strlen(entry->d_name);
+
+        if (strncmp(entry->d_name, "resume_", 7) != 0 || length < 5 || length >= sizeof(map)
+            || strcmp(entry->d_name + length - 5, ".part") != 0
+            || stat(entry->d_name, &info) < 0 || now - info.st_mtime < resume_age) {
+            continue;
+        }
+
+        int fd = open(entry->d_name, O_RDWR | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        // The lock is only good for the file still under the name, and
+        // the map goes first, while that file holds it: a worker opens
+        // the map once it holds the lock on the file under the name, so
+        // it never gets the map being removed
+        struct stat held;
+        if (flock(fd, LOCK_EX | LOCK_NB) == 0 && fstat(fd, &held) == 0
+            && stat(entry->d_name, &info) == 0 && held.st_ino == info.st_ino) {
+            strcpy(map, entry->d_name);
+            strcpy(map + length - 5, ".map");
+            unlink(map);
+            unlink(entry->d_name);
+            printf("[+]Removed %s, no sender came back to it.\n", entry->d_name);
+            fflush(stdout);
+        }
+        close(fd);
+    }
+    closedir(dir);
+}
+
+// The header and name are in, the size is known before any of the
+// payload: reject what can't be taken and reserve the space for the
+// rest. Gives TRANSFER_STORED when the payload can come, and
+// TRANSFER_BAD_HEADER, with nothing on disk, for a frame whose chunked
+// flag does not fit its length, as its payload can't be told apart.
+int start_file(struct connection *conn) {
+    char *name = (char *)conn->header + TRANSFER_HEADER_SIZE;
+    name[conn->frame.name_length] = '\0';
+
+    if (!clean_name(name)) {
+        fprintf(stderr, "[-]Rejected a file without a usable name.\n");
+        return TRANSFER_BAD_NAME;
+    }
+    if (!(conn->frame.type & TRANSFER_CHUNKED) != !transfer_chunked(conn->frame.length)) {
+        fprintf(stderr, "[-]Rejected %s, its chunked flag does not fit %llu bytes.\n", name, conn->frame.length);
+        return TRANSFER_BAD_HEADER;
+    }
+    if (max_size && conn->frame.length > max_size) {
+        fprintf(stderr, "[-]Rejected %s, %llu bytes is over the limit.\n", name, conn->frame.length);
+        return TRANSFER_TOO_LARGE;
+    }
+
+    if (conn->frame.type & TRANSFER_CHUNKED) {
+        return open_resume_file(conn);
+    }
+
+    strcpy(conn->temp, "recv.XXXXXX.part");
+    conn->fd = mkstemps(conn->temp, 5);
+    if (conn->fd < 0) {
+        perror("[-]Error in opening file.");
+        return TRANSFER_FAILED;
+    }
+
+    if (conn->frame.length > 0 && fallocate(conn->fd, 0, 0, conn->frame.length) < 0
+        && errno != EOPNOTSUPP && errno != ENOSYS) {
+        fprintf(stderr, "[-]Rejected %s, no room for %llu bytes: %s\n", name, conn->frame.length, strerror(errno));
+        discard_file(conn);
+        return TRANSFER_NO_ROOM;
+    }
+
+    // The payload is hashed as it comes in
+    conn->hash = sha512_begin();
+    return TRANSFER_STORED;
+}
+
+// The whole payload is in: check it against the SHA-512 the sender put
+// in the header, then store it. A plain payload was hashed on the way
+// in, a chunked file came in over several connections and its root is
+// made from the leaves of its verified chunks. Gives the status to
+// acknowledge the file with.
+int finish_file(struct connection *conn) {
+    unsigned char digest[64];
+
+    if (conn->hash) {
+        sha512_end(conn->hash, digest);
+        conn->hash = NULL;
+    } else {
+        sha512_tree_root(conn->leaves, conn->chunks, digest);
+    }
+
+    const char *name = (const char *)conn->header + TRANSFER_HEADER_SIZE;
+    if (memcmp(digest, conn->frame.digest, 64) != 0) {
+        fprintf(stderr, "[-]Rejected %s, the data does not match its SHA-512.\n", name);
+        // Verified chunks that don't add up to the file are no use either
+        if (conn->mapfd >= 0) {
+            unlink(conn->temp);
+            unlink(conn->map);
+        }
+        discard_file(conn);
+        return TRANSFER_BAD_DIGEST;
+    }
+
+    // Stored while the file is still open, so a chunked file stays
+    // locked until it is gone from its resume name
+    char filename[320];
+    int stored = store_file(conn, filename, sizeof(filename));
+    if (conn->mapfd >= 0) {
+        unlink(conn->map);
+    }
+    if (close(conn->fd) != 0 && stored == 0) {
+        perror("[-]Error in writing to file.");
+        unlink(filename);
+        stored = -1;
+    }
+    conn->fd = -1;
+    discard_file(conn);
+
+    if (stored < 0) {
+        return TRANSFER_FAILED;
+    }
+
+    printf("[+]Data written to %s successfully (%llu bytes).\n", filename, conn->received);
+    fflush(stdout);
+    return TRANSFER_STORED;
+}
+
+void queue_bytes(struct connection *conn, const unsigned char *data, size_t size) {
+    if (conn->out_have + size > conn->out_capacity) {
+        size_t capacity = conn->out_capacity ? conn->out_capacity : OUT_LIMIT;
+        while (capacity < conn->out_have + size) {
+            capacity *= 2;
+        }
+
+        unsigned char *out = realloc(conn->out, capacity);
+        if (out == NULL) {
+            perror("[-]Error in allocating buffer");
+            exit(1);
+        }
+        conn->out = out;
+        conn->out_capacity = capacity;
+    }
+
+    memcpy(conn->out + conn->out_have, data, size);
+    conn->out_have += size;
+}
+
+void queue_ack(struct connection *conn, int status, unsigned long long stored) {
+    unsigned char ack[TRANSFER_ACK_SIZE];
+    transfer_encode_ack(status, stored, ack);
+    queue_bytes(conn, ack, sizeof(ack));
+}
+
+// The map of a chunked file, the sender waits for it
+void queue_map(struct connection *conn) {
+    unsigned char have[TRANSFER_HAVE_SIZE];
+    transfer_put(have, TRANSFER_HAVE_MAGIC, 4);
+    transfer_put(have + 4, conn->chunks, 8);
+
+    queue_bytes(conn, have, sizeof(have));
+    queue_bytes(conn, conn->chunk_map, (conn->chunks + 7) / 8);
+}
+
+// Send what the socket takes of the queued acknowledgements
+int flush_acks(struct connection *conn) {
+    size_t sent = 0;
+
+    while (sent < conn->out_have) {
+        ssize_t n = send(conn->sockfd, conn->out + sent, conn->out_have - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                break;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        sent += n;
+    }
+
+    memmove(conn->out, conn->out + sent, conn->out_have - sent);
+    conn->out_have -= sent;
+    return 0;
+}
+
+// Wait for the socket to be readable while there is room for another
+// acknowledgement, and writable while some are queued. A sender that
+// does not read its acknowledgements is not read from either.
+void watch_connection(struct worker *w, struct connection *conn) {
+    unsigned int events = 0;
+
+    if (!conn->closing && conn->out_have + TRANSFER_ACK_SIZE <= OUT_LIMIT) {
+        events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (conn->out_have > 0) {
+        events |= EPOLLOUT;
+    }
+
+    if (events != conn->events) {
+        struct epoll_event ev = { .events = events, .data.ptr = conn };
+        epoll_ctl(w->epfd, EPOLL_CTL_MOD, conn->sockfd, &ev);
+        conn->events = events;
+    }
+}
+
+// Read the header, then the name, never past the end of the frame. 1
+// once they are complete, 0 while more has to come, -1 on an error. A
+// connection that closes between two frames is done, that is 2.
+int read_frame(struct connection *conn) {
     while (1) {
-        n = recv(sockfd, buffer, SIZE, 0);
-        if (n <= 0) {
-            if (n < 0) {
-                perror("[-]Error in receiving file.");
+        size_t need = TRANSFER_HEADER_SIZE;
+        if (conn->stage == READING_NAME) {
+            need += conn->frame.name_length;
+        }
+        if (conn->have == need) {
+            return 1;
+        }
+        if (conn->budget <= 0) {
+            return 0;
+        }
+
+        ssize_t n = recv(conn->sockfd, conn->header + conn->have, need - conn->have, 0);
+        if (n == 0) {
+            if (conn->stage == READING_HEADER && conn->have == 0) {
+                return 2;
             }
-            break;
+            fprintf(stderr, "[-]Connection closed inside a header.\n");
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[-]Error in receiving file.");
+            return -1;
+        }
+        conn->have += n;
+        conn->budget -= n;
+
+        if (conn->stage == READING_HEADER && conn->have == TRANSFER_HEADER_SIZE) {
+            if (!transfer_decode(conn->header, &conn->frame)) {
+                // Nothing after it can be trusted to be a frame, say why and close
+                fprintf(stderr, "[-]Rejected a connection that does not speak version %d.\n", TRANSFER_VERSION);
+                queue_ack(conn, TRANSFER_BAD_HEADER, 0);
+                conn->closing = 1;
+                return 0;
+            }
+            conn->stage = READING_NAME;
         }
-        size_t written = fwrite(buffer, 1, n, fp);
-        if (written < n) {
+    }
+}
+
+// Read the index and leaf digest in front of a chunk. 1 once they are in, 0
+// while more has to come, -1 on an error or a chunk the server did not
+// ask for.
+int read_chunk_header(struct connection *conn) {
+    while (conn->chunk_have < TRANSFER_CHUNK_HEADER_SIZE) {
+        if (conn->budget <= 0) {
+            return 0;
+        }
+        ssize_t n = recv(conn->sockfd, conn->chunk_header + conn->chunk_have,
+                         TRANSFER_CHUNK_HEADER_SIZE - conn->chunk_have, 0);
+        if (n == 0) {
+            fprintf(stderr, "[-]Connection closed inside a chunked file, its chunks are kept.\n");
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[-]Error in receiving file.");
+            return -1;
+        }
+        conn->chunk_have += n;
+        conn->budget -= n;
+    }
+
+    conn->chunk = transfer_get(conn->chunk_header, 8);
+    if (conn->chunk >= conn->chunks || transfer_has_chunk(conn->chunk_map, conn->chunk)) {
+        fprintf(stderr, "[-]Rejected a connection that sent chunk %llu unasked.\n", conn->chunk);
+        return -1;
+    }
+
+    unsigned long long offset = conn->chunk * TRANSFER_CHUNK_SIZE;
+    conn->chunk_length = conn->frame.length - offset < TRANSFER_CHUNK_SIZE
+                       ? conn->frame.length - offset : TRANSFER_CHUNK_SIZE;
+    conn->chunk_received = 0;
+    conn->hash = sha512_leaf_begin();
+    conn->stage = READING_CHUNK;
+    return 1;
+}
+
+// The chunk is in: one that matches its leaf is marked in the map, on
+// disk as well, so it is never asked for again. The leaf is written
+// before the mark, a marked chunk always has its leaf for the root. 1,
+// or -1 when the map can't be written.
+int check_chunk(struct connection *conn) {
+    unsigned char digest[64];
+    sha512_end(conn->hash, digest);
+    conn->hash = NULL;
+
+    if (memcmp(digest, conn->chunk_header + 8, 64) == 0) {
+        unsigned long long byte = conn->chunk >> 3;
+        unsigned char *leaf = conn->leaves + 64 * conn->chunk;
+        memcpy(leaf, digest, 64);
+        conn->chunk_map[byte] |= 0x80 >> (conn->chunk & 7);
+        if (pwrite(conn->mapfd, leaf, 64, (conn->chunks + 7) / 8 + 64 * conn->chunk) != 64
+            || pwrite(conn->mapfd, conn->chunk_map + byte, 1, byte) != 1) {
             perror("[-]Error in writing to file.");
+            return -1;
+        }
+        conn->verified++;
+    } else {
+        fprintf(stderr, "[-]Chunk %llu of %s failed its SHA-512.\n", conn->chunk,
+                (const char *)conn->header + TRANSFER_HEADER_SIZE);
+    }
+
+    conn->missing--;
+    conn->chunk_have = 0;
+    conn->stage = READING_CHUNK_HEADER;
+    return 1;
+}
+
+// Write a chunk in its place in the file, hashing it on the way. 1 once
+// the chunk is in, 0 while more has to come, -1 on an error.
+int read_chunk(struct connection *conn, unsigned char *buffer) {
+    while (conn->chunk_received < conn->chunk_length) {
+        if (conn->budget <= 0) {
+            return 0;
+        }
+        unsigned long long left = conn->chunk_length - conn->chunk_received;
+        ssize_t n = recv(conn->sockfd, buffer, left < SIZE ? left : SIZE, 0);
+        if (n == 0) {
+            fprintf(stderr, "[-]Connection closed inside a chunked file, its chunks are kept.\n");
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[-]Error in receiving file.");
+            return -1;
+        }
+
+        unsigned long long offset = conn->chunk * TRANSFER_CHUNK_SIZE + conn->chunk_received;
+        ssize_t done = 0;
+        while (done < n) {
+            ssize_t written = pwrite(conn->fd, buffer + done, n - done, offset + done);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("[-]Error in writing to file.");
+                return -1;
+            }
+            done += written;
+        }
+
+        sha512_add(conn->hash, buffer, n);
+        conn->chunk_received += n;
+        conn->budget -= n;
+    }
+    return check_chunk(conn);
+}
+
+// Read payload bytes until the socket would block, never past the end of
+// the payload. 1 when the payload is complete, 0 while it goes on, -1 on
+// an error or when the sender stops early. A rejected payload is only
+// counted, not written or hashed.
+int read_connection(struct connection *conn, unsigned char *buffer) {
+    while (conn->received < conn->frame.length) {
+        if (conn->budget <= 0) {
+            return 0;
+        }
+        unsigned long long left = conn->frame.length - conn->received;
+        ssize_t n = recv(conn->sockfd, buffer, left < SIZE ? left : SIZE, 0);
+        if (n == 0) {
+            fprintf(stderr, "[-]Connection closed after %llu of %llu bytes.\n", conn->received, conn->frame.length);
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[-]Error in receiving file.");
+            return -1;
+        }
+
+        ssize_t done = n;
+        if (conn->stage == READING_BODY) {
+            sha512_add(conn->hash, buffer, n);
+            done = 0;
+        }
+        while (done < n) {
+            ssize_t written = write(conn->fd, buffer + done, n - done);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                perror("[-]Error in writing to file.");
+                return -1;
+            }
+            done += written;
+        }
+        conn->received += n;
+        conn->budget -= n;
+    }
+    return 1;
+}
+
+// The pipes for splice and tee, as large as the system allows. On
+// failure the worker copies through its buffer instead.
+void open_pipe(struct worker *w) {
+    if (pipe2(w->pipefd, O_CLOEXEC) < 0) {
+        w->pipefd[0] = w->pipefd[1] = -1;
+        return;
+    }
+    if (pipe2(w->teefd, O_CLOEXEC) < 0) {
+        close(w->pipefd[0]);
+        close(w->pipefd[1]);
+        w->pipefd[0] = w->pipefd[1] = -1;
+        return;
+    }
+    fcntl(w->pipefd[1], F_SETPIPE_SZ, PIPE_SIZE);
+    fcntl(w->teefd[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    int size = fcntl(w->pipefd[1], F_GETPIPE_SZ);
+    int tee_size = fcntl(w->teefd[1], F_GETPIPE_SZ);
+    w->pipe_size = size < tee_size ? size : tee_size;
+}
+
+void close_pipe(struct worker *w) {
+    if (w->pipefd[0] >= 0) {
+        close(w->pipefd[0]);
+        close(w->pipefd[1]);
+        close(w->teefd[0]);
+        close(w->teefd[1]);
+    }
+    w->pipefd[0] = w->pipefd[1] = -1;
+}
+
+// Move n bytes that were spliced into the pipe on to fd, at *offset or,
+// without one, at the file position. tee puts the same pages in the
+// second pipe, which is read into the buffer for the hash, so the file
+// is never read back. 0 when the pipes are empty again, -1 on an error.
+int drain_pipe(struct worker *w, int fd, loff_t *offset, size_t n, void *hash, unsigned char *buffer) {
+    while (n > 0) {
+        ssize_t copied = tee(w->pipefd[0], w->teefd[1], n, 0);
+        if (copied < 0 && errno == EINTR) {
+            continue;
+        }
+        if (copied <= 0) {
             break;
         }
-        bzero(buffer, SIZE);
+
+        for (ssize_t left = copied; left > 0; ) {
+            ssize_t got = read(w->teefd[0], buffer, left < SIZE ? left : SIZE);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                goto failed;
+            }
+            sha512_add(hash, buffer, got);
+            left -= got;
+        }
+
+        for (ssize_t left = copied; left > 0; ) {
+            ssize_t moved = splice(w->pipefd[0], NULL, fd, offset, left, SPLICE_F_MOVE);
+            if (moved < 0 && errno == EINTR) {
+                continue;
+            }
+            if (moved <= 0) {
+                goto failed;
+            }
+            left -= moved;
+        }
+        n -= copied;
+    }
+    if (n == 0) {
+        return 0;
     }
 
-    fclose(fp);
-    return;
+failed:
+    // What is left in the pipes belongs to this upload, start over
+    perror("[-]Error in writing to file.");
+    close_pipe(w);
+    open_pipe(w);
+    return -1;
 }
 
-int main() {
+// Same as read_connection, but the data goes from the socket into the
+// pipe and from the pipe into the file without being copied to user
+// space, only the copy for the hash is. The pipes are emptied every
+// time, so they serve every connection of the worker. -2 when splice
+// can't be used here.
+int splice_connection(struct worker *w, struct connection *conn, unsigned char *buffer) {
+    while (conn->received < conn->frame.length) {
+        if (conn->budget <= 0) {
+            return 0;
+        }
+        unsigned long long left = conn->frame.length - conn->received;
+        ssize_t n = splice(conn->sockfd, NULL, w->pipefd[1], NULL, left < w->pipe_size ? left : w->pipe_size,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            fprintf(stderr, "[-]Connection closed after %llu of %llu bytes.\n", conn->received, conn->frame.length);
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS) {
+                return -2;
+            }
+            perror("[-]Error in receiving file.");
+            return -1;
+        }
+
+        if (drain_pipe(w, conn->fd, NULL, n, conn->hash, buffer) < 0) {
+            return -1;
+        }
+        conn->received += n;
+        conn->budget -= n;
+    }
+    return 1;
+}
+
+// Same as read_chunk, through the pipes: the chunk is spliced to its
+// place in the file and hashed from the tee copy as it lands. -2 when
+// splice can't be used here.
+int splice_chunk(struct worker *w, struct connection *conn, unsigned char *buffer) {
+    while (conn->chunk_received < conn->chunk_length) {
+        if (conn->budget <= 0) {
+            return 0;
+        }
+        unsigned long long left = conn->chunk_length - conn->chunk_received;
+        ssize_t n = splice(conn->sockfd, NULL, w->pipefd[1], NULL, left < w->pipe_size ? left : w->pipe_size,
+                           SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            fprintf(stderr, "[-]Connection closed inside a chunked file, its chunks are kept.\n");
+            return -1;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EINVAL || errno == ENOSYS) {
+                return -2;
+            }
+            perror("[-]Error in receiving file.");
+            return -1;
+        }
+
+        loff_t offset = conn->chunk * TRANSFER_CHUNK_SIZE + conn->chunk_received;
+        if (drain_pipe(w, conn->fd, &offset, n, conn->hash, buffer) < 0) {
+            return -1;
+        }
+        conn->chunk_received += n;
+        conn->budget -= n;
+    }
+    return check_chunk(conn);
+}
+
+// Take in what the socket has, up to WAKEUP_BUDGET bytes: headers, names
+// and payloads of as many frames as there are, each answered with an
+// acknowledgement. 0 while the connection stays, otherwise it is done.
+int serve_connection(struct worker *w, struct connection *conn, unsigned char *buffer) {
+    // A sender that keeps its socket full would hold the worker, the rest
+    // waits for the next epoll_wait, which reports the socket again
+    conn->budget = WAKEUP_BUDGET;
+
+    while (!conn->closing && conn->out_have + TRANSFER_ACK_SIZE <= OUT_LIMIT) {
+        int state;
+
+        if (conn->stage == READING_HEADER || conn->stage == READING_NAME) {
+            state = read_frame(conn);
+            if (state == 2) {
+                conn->closing = 1;
+                break;
+            }
+            if (state <= 0) {
+                if (state < 0) {
+                    return -1;
+                }
+                break;
+            }
+
+            int status = start_file(conn);
+            if (status == TRANSFER_BAD_HEADER) {
+                // Nothing after it can be trusted to be a frame
+                queue_ack(conn, status, 0);
+                conn->closing = 1;
+                break;
+            }
+            conn->received = 0;
+            conn->stage = READING_BODY;
+            if (conn->frame.type & TRANSFER_CHUNKED) {
+                // The sender waits for the map before any chunk, after a
+                // rejection it sends none
+                if (status != TRANSFER_STORED) {
+                    queue_ack(conn, status, 0);
+                    conn->stage = READING_HEADER;
+                    conn->have = 0;
+                    continue;
+                }
+                queue_map(conn);
+                conn->chunk_have = 0;
+                conn->stage = READING_CHUNK_HEADER;
+            } else if (status != TRANSFER_STORED) {
+                // Answer now, the sender may already be sending the payload
+                queue_ack(conn, status, 0);
+                conn->stage = SKIPPING_BODY;
+            }
+        }
+
+        if (conn->stage == READING_CHUNK_HEADER || conn->stage == READING_CHUNK) {
+            state = 1;
+            while (state == 1 && conn->missing > 0) {
+                if (conn->stage == READING_CHUNK_HEADER) {
+                    state = read_chunk_header(conn);
+                    continue;
+                }
+                state = -2;
+                if (w->pipefd[0] >= 0) {
+                    state = splice_chunk(w, conn, buffer);
+                }
+                if (state == -2) {
+                    close_pipe(w);
+                    state = read_chunk(conn, buffer);
+                }
+            }
+        } else {
+            state = -2;
+            if (conn->stage == READING_BODY && w->pipefd[0] >= 0) {
+                state = splice_connection(w, conn, buffer);
+            }
+            if (state == -2) {
+                // Not supported for these files, copy from now on
+                if (conn->stage == READING_BODY) {
+                    close_pipe(w);
+                }
+                state = read_connection(conn, buffer);
+            }
+        }
+        if (state < 0) {
+            return -1;
+        }
+        if (state == 0) {
+            break;
+        }
+
+        if (conn->stage == READING_BODY) {
+            int status = finish_file(conn);
+            queue_ack(conn, status, status == TRANSFER_STORED ? conn->received : 0);
+        } else if (conn->stage != SKIPPING_BODY) {
+            // Every chunk this sender had to send is in
+            int status = TRANSFER_INCOMPLETE;
+            if (conn->verified == conn->chunks) {
+                conn->received = conn->frame.length;
+                status = finish_file(conn);
+            } else {
+                discard_file(conn);
+            }
+            queue_ack(conn, status, status == TRANSFER_STORED ? conn->received : 0);
+        }
+
+        // Ready for the next frame on this connection
+        conn->stage = READING_HEADER;
+        conn->have = 0;
+    }
+
+    if (flush_acks(conn) < 0) {
+        return -1;
+    }
+    if (conn->closing && conn->out_have == 0) {
+        return 1;
+    }
+
+    watch_connection(w, conn);
+    return 0;
+}
+
+void *run_worker(void *arg) {
+    struct worker *w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    unsigned char *buffer = malloc(SIZE);
+
+    if (buffer == NULL) {
+        perror("[-]Error in allocating buffer");
+        return NULL;
+    }
+
+    while (!stop) {
+        int n = epoll_wait(w->epfd, events, MAX_EVENTS, 1000);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("[-]Error in epoll");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            struct connection *conn = events[i].data.ptr;
+
+            if (conn == NULL) {
+                accept_connections(w);
+                continue;
+            }
+
+            if (serve_connection(w, conn, buffer) != 0) {
+                close_connection(w, conn);
+            }
+        }
+    }
+
+    while (w->open) {
+        close_connection(w, w->open);
+    }
+    close_pipe(w);
+
+    free(buffer);
+    return NULL;
+}
+
+int main(int argc, char *argv[]) {
     char *ip = "127.0.0.1";
     int port = 8080;
+    int workers = sysconf(_SC_NPROCESSORS_ONLN);
     int e;
 
-    int sockfd, new_sock;
-    struct sockaddr_in server_addr, new_addr;
-    socklen_t addr_size;
-    char buffer[SIZE];
+    struct sockaddr_in server_addr;
 
-    sockfd = socket(AF_INET, SOCK_STREAM, 0);
-    if (sockfd < 0) {
+    // --once serves a single connection and exits, --workers N sets the pool
+    // size, --max-size N rejects files over N bytes before any is written,
+    // --resume-age N removes resume files left untouched for N seconds
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--once") == 0) {
+            once = 1;
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--resume-age") == 0 && i + 1 < argc) {
+            resume_age = atol(argv[++i]);
+        } else {
+            fprintf(stderr, "usage: %s [--once] [--workers N] [--max-size N] [--resume-age N]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (once || workers < 1) {
+        workers = 1;
+    }
+    if (workers > MAX_WORKERS) {
+        workers = MAX_WORKERS;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+
+    listen_sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_sock < 0) {
         perror("[-]Error in socket");
         exit(1);
     }
     printf("[+]Server socket created successfully.\n");
 
+    int reuse = 1;
+    setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = port;
     server_addr.sin_addr.s_addr = inet_addr(ip);
 
-    e = bind(sockfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+    e = bind(listen_sock, (struct sockaddr*)&server_addr, sizeof(server_addr));
     if (e < 0) {
         perror("[-]Error in bind");
         exit(1);
     }
     printf("[+]Binding successful.\n");
 
-    if (listen(sockfd, 10) == 0) {
+    if (listen(listen_sock, SOMAXCONN) == 0) {
         printf("[+]Listening....\n");
     } else {
         perror("[-]Error in listening");
         exit(1);
     }
+    fflush(stdout);
+
+    struct worker pool[MAX_WORKERS];
+
+    for (int i = 0; i < workers; i++) {
+        pool[i].clients = 0;
+        pool[i].listening = 1;
+        pool[i].open = NULL;
+        open_pipe(&pool[i]);
+        pool[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (pool[i].epfd < 0) {
+            perror("[-]Error in epoll");
+            exit(1);
+        }
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+        if (epoll_ctl(pool[i].epfd, EPOLL_CTL_ADD, listen_sock, &ev) < 0) {
+            perror("[-]Error in epoll");
+            exit(1);
+        }
+
+        if (pthread_create(&pool[i].thread, NULL, run_worker, &pool[i]) != 0) {
+            perror("[-]Error in starting worker");
+            exit(1);
+        }
+    }
+
+    // Meanwhile this thread clears out resume files no sender came back to
+    time_t swept = 0;
+    while (!stop) {
+        if (resume_age > 0 && time(NULL) - swept >= SWEEP_INTERVAL) {
+            sweep_resume_files();
+            swept = time(NULL);
+        }
+        sleep(1);
+    }
+
+    for (int i = 0; i < workers; i++) {
+        pthread_join(pool[i].thread, NULL);
+        close(pool[i].epfd);
+    }
 
-    addr_size = sizeof(new_addr);
-    new_sock = accept(sockfd, (struct sockaddr*)&new_addr, &addr_size);
-    write_file(new_sock);
-    printf("[+]Data written to the file successfully.\n");
+    close(listen_sock);
+    printf("[+]Server stopped.\n");
 
     return 0;
 }
@@ -4,11 +4,12 @@
 #include <sys/wait.h>
 
 void runServer() {
-    system("gcc server5.c -o server");
-    system("./server");
+    system("gcc server5.c sha512Interface.cpp -o server -pthread -lstdc++");
+    // The menu sends over one connection, so the server stops after it
+    system("./server --once");
 }
 
 void runClient() {
-    system("gcc client5.c -o client");
+    system("gcc client5.c sha512Interface.cpp -o client -pthread -lstdc++");
     system("./client");
 }
\ No newline at end of file
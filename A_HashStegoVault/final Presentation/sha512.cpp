@@ -8,11 +8,11 @@ using namespace std;
 
 typedef unsigned long long int int64;
 
-int64 Message[80];
-
 // Stores the hexadecimal values for
-// calculating hash values
-const int64 Constants[80]
+// calculating hash values, constexpr like
+// every part of the hash, so a digest can
+// be computed by the compiler
+constexpr int64 Constants[80]
 	= { 0x428a2f98d728ae22, 0x7137449123ef65cd,
 		0xb5c0fbcfec4d3b2f, 0xe9b5dba58189dbbc,
 		0x3956c25bf348b538, 0x59f111f1b605d019,
@@ -54,148 +54,96 @@ const int64 Constants[80]
 		0x4cc5d4becb3e42b6, 0x597f299cfc657e2a,
 		0x5fcb6fab3ad6faec, 0x6c44198c4a475817 };
 
-// Function to convert a binary string
-// to hexa-decimal value
-string gethex(string bin)
+// Stores the hash values a message starts from
+constexpr int64 InitialHash[8]
+	= { 0x6a09e667f3bcc908, 0xbb67ae8584caa73b,
+		0x3c6ef372fe94f82b, 0xa54ff53a5f1d36f1,
+		0x510e527fade682d1, 0x9b05688c2b3e6c1f,
+		0x1f83d9abfb41bd6b, 0x5be0cd19137e2179 };
+
+// Stores the hexadecimal digit of
+// every 4 bit value
+constexpr char HexDigits[17] = "0123456789abcdef";
+
+// Stores the value of every character
+// as a hexadecimal digit, -1 if it is none
+struct HexTable {
+	signed char value[256] = {};
+};
+
+constexpr HexTable makeHexTable()
 {
-	if (bin == "0000")
-		return "0";
-	if (bin == "0001")
-		return "1";
-	if (bin == "0010")
-		return "2";
-	if (bin == "0011")
-		return "3";
-	if (bin == "0100")
-		return "4";
-	if (bin == "0101")
-		return "5";
-	if (bin == "0110")
-		return "6";
-	if (bin == "0111")
-		return "7";
-	if (bin == "1000")
-		return "8";
-	if (bin == "1001")
-		return "9";
-	if (bin == "1010")
-		return "a";
-	if (bin == "1011")
-		return "b";
-	if (bin == "1100")
-		return "c";
-	if (bin == "1101")
-		return "d";
-	if (bin == "1110")
-		return "e";
-	if (bin == "1111")
-		return "f";
+	HexTable table;
+	for (int c = 0; c < 256; c++)
+		table.value[c] = -1;
+	for (int v = 0; v < 16; v++) {
+		table.value[(unsigned char)HexDigits[v]] = v;
+		table.value[(unsigned char)"0123456789ABCDEF"[v]] = v;
+	}
+	return table;
 }
 
-// Function to convert a decimal value
-// to hexa decimal value
-string decimaltohex(int64 deci)
+constexpr HexTable HexValues = makeHexTable();
+
+// Function to load 8 bytes as a
+// big-endian 64 bit word, Byte is char
+// for string literals hashed at compile
+// time and unsigned char otherwise
+template <typename Byte>
+constexpr int64 loadWord(const Byte* p)
 {
-	// Stores the value as string
-	string EQBIN = bitset<64>(deci).to_string();
-
-	// Stores the equivalent hexa decimal
-	string hexstring = "";
-	string temp;
-
-	// Traverse the string EQBIN
-	for (unsigned int i = 0;
-		i < EQBIN.length(); i += 4) {
-		temp = EQBIN.substr(i, 4);
-		hexstring += gethex(temp);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+	// At run time one load and a byte swap
+	if (!__builtin_is_constant_evaluated()) {
+		int64 word = 0;
+		memcpy(&word, p, 8);
+		return __builtin_bswap64(word);
 	}
-
-	// Return the hexstring
-	return hexstring;
+#endif
+	int64 value = 0;
+	for (int i = 0; i < 8; i++)
+		value = (value << 8) | (unsigned char)p[i];
+	return value;
 }
 
-// Function to convert a binary
-// string to decimal value
-int64 BintoDec(string bin)
+// Function to store a 64 bit word
+// as 8 big-endian bytes
+constexpr void storeWord(unsigned char* p, int64 value)
 {
-
-	int64 value = bitset<64>(bin)
-					.to_ullong();
-	return value;
+	for (int i = 7; i >= 0; i--) {
+		p[i] = value & 0xff;
+		value >>= 8;
+	}
 }
 
 // Function to right rotate x by n bits
-int64 rotate_right(int64 x, int n)
+constexpr int64 rotate_right(int64 x, int n)
 {
 	return (x >> n) | (x << (64 - n));
 }
 
 // Function to right shift x by n bits
-int64 shift_right(int64 x, int n)
+constexpr int64 shift_right(int64 x, int n)
 {
 	return (x >> n);
 }
 
-// Function to divide the string
-// into chunks
-void separator(string getBlock)
-{
-	// Stores the size of chunks
-	int chunknum = 0;
-
-	// Traverse the string S
-	for (unsigned int i = 0;
-		i < getBlock.length();
-		i += 64, ++chunknum) {
-
-		// Update the Message[chunknum]
-		Message[chunknum]
-			= BintoDec(getBlock.substr(i, 64));
-	}
-
-	// Iterate over the range [16, 80]
-	for (int g = 16; g < 80; ++g) {
-
-		// Find the WordA
-		int64 WordA = rotate_right(Message[g - 2], 19)
-					^ rotate_right(Message[g - 2], 61)
-					^ shift_right(Message[g - 2], 6);
-
-		// Find the WordB
-		int64 WordB = Message[g - 7];
-
-		// Find the WordC
-		int64 WordC = rotate_right(Message[g - 15], 1)
-					^ rotate_right(Message[g - 15], 8)
-					^ shift_right(Message[g - 15], 7);
-
-		// Find the WordD
-		int64 WordD = Message[g - 16];
-
-		// Find the resultant code
-		int64 T = WordA + WordB + WordC + WordD;
-
-		// Return the resultant Hash Code
-		Message[g] = T;
-	}
-}
-
 // Function to find the major of a, b, c
-int64 maj(int64 a, int64 b, int64 c)
+constexpr int64 maj(int64 a, int64 b, int64 c)
 {
 	return (a & b) ^ (b & c) ^ (c & a);
 }
 
 // Function to find the ch value of a,
 // b, and c
-int64 Ch(int64 e, int64 f, int64 g)
+constexpr int64 Ch(int64 e, int64 f, int64 g)
 {
 	return (e & f) ^ (~e & g);
 }
 
 // Function to find the Bitwise XOR with
 // the right rotate over 14, 18, and 41
-int64 sigmaE(int64 e)
+constexpr int64 sigmaE(int64 e)
 {
 	// Return the resultant value
 	return rotate_right(e, 14)
@@ -205,7 +153,7 @@ int64 sigmaE(int64 e)
 
 // Function to find the Bitwise XOR with
 // the right rotate over 28, 34, and 39
-int64 sigmaA(int64 a)
+constexpr int64 sigmaA(int64 a)
 {
 
 	// Return the resultant value
@@ -214,13 +162,41 @@ int64 sigmaA(int64 a)
 		^ rotate_right(a, 39);
 }
 
-// Function to generate the hash code
+// Function to find the schedule term
+// of the word 15 places back
+constexpr int64 sigma0(int64 x)
+{
+	return rotate_right(x, 1)
+		^ rotate_right(x, 8)
+		^ shift_right(x, 7);
+}
+
+// Function to find the schedule term
+// of the word 2 places back
+constexpr int64 sigma1(int64 x)
+{
+	return rotate_right(x, 19)
+		^ rotate_right(x, 61)
+		^ shift_right(x, 6);
+}
+
+// Function to run round K. The message schedule
+// is a rolling window of 16 words: from round 16
+// on, word K takes the place of word K - 16.
+// The eight hash values rotate through the
+// parameters, so no value is moved between rounds.
+template <int K>
+constexpr inline __attribute__((always_inline))
 void Func(int64 a, int64 b, int64 c,
 		int64& d, int64 e, int64 f,
-		int64 g, int64& h, int K)
+		int64 g, int64& h, int64 W[16])
 {
+	if (K >= 16)
+		W[K & 15] += sigma1(W[(K - 2) & 15]) + W[(K - 7) & 15]
+					+ sigma0(W[(K - 15) & 15]);
+
 	// Find the Hash Code
-	int64 T1 = h + Ch(e, f, g) + sigmaE(e) + Message[K]
+	int64 T1 = h + Ch(e, f, g) + sigmaE(e) + W[K & 15]
 			+ Constants[K];
 	int64 T2 = sigmaA(a) + maj(a, b, c);
 
@@ -228,189 +204,339 @@ void Func(int64 a, int64 b, int64 c,
 	h = T1 + T2;
 }
 
-// Function to convert the hash value
-// of a given string
-string SHA512(string myString)
+// Function to run rounds K to K + 7
+template <int K>
+constexpr inline __attribute__((always_inline))
+void Rounds(int64& A, int64& B, int64& C, int64& D,
+		int64& E, int64& F, int64& G, int64& H, int64 W[16])
+{
+	Func<K>(A, B, C, D, E, F, G, H, W);
+	Func<K + 1>(H, A, B, C, D, E, F, G, W);
+	Func<K + 2>(G, H, A, B, C, D, E, F, W);
+	Func<K + 3>(F, G, H, A, B, C, D, E, W);
+	Func<K + 4>(E, F, G, H, A, B, C, D, W);
+	Func<K + 5>(D, E, F, G, H, A, B, C, W);
+	Func<K + 6>(C, D, E, F, G, H, A, B, W);
+	Func<K + 7>(B, C, D, E, F, G, H, A, W);
+}
+
+// Function to unroll all 80 rounds at compile time
+template <size_t... I>
+constexpr inline __attribute__((always_inline))
+void allRounds(int64& A, int64& B, int64& C, int64& D,
+		int64& E, int64& F, int64& G, int64& H, int64 W[16],
+		index_sequence<I...>)
+{
+	(Rounds<8 * I>(A, B, C, D, E, F, G, H, W), ...);
+}
+
+// Function to run the compression over
+// one 128 byte block, all state is local
+// so any number of threads can hash at once
+template <typename Byte>
+constexpr void compressBlock(int64 state[8], const Byte* block)
+{
+	int64 W[16] = {};
+	for (int t = 0; t < 16; t++)
+		W[t] = loadWord(block + 8 * t);
+
+	int64 A = state[0], B = state[1], C = state[2], D = state[3];
+	int64 E = state[4], F = state[5], G = state[6], H = state[7];
+
+	allRounds(A, B, C, D, E, F, G, H, W, make_index_sequence<10>());
+
+	// Update the value of A, B, C,
+	// D, E, F, G, H
+	state[0] += A;
+	state[1] += B;
+	state[2] += C;
+	state[3] += D;
+	state[4] += E;
+	state[5] += F;
+	state[6] += G;
+	state[7] += H;
+}
+
+// Incremental hasher: the hash values, up to
+// 127 bytes not yet hashed and the message
+// length in bits as a 128 bit counter
+struct SHA512Context {
+	int64 state[8] = {};
+	unsigned char buffer[128] = {};
+	size_t buffered = 0;
+	int64 lengthHigh = 0;
+	int64 lengthLow = 0;
+};
+
+// Function to start a new message
+constexpr void sha512Init(SHA512Context& ctx)
+{
+	for (int i = 0; i < 8; i++)
+		ctx.state[i] = InitialHash[i];
+	ctx.buffered = 0;
+	ctx.lengthHigh = 0;
+	ctx.lengthLow = 0;
+}
+
+// Function to hash the next size bytes
+// of the message
+template <typename Byte>
+constexpr void sha512Update(SHA512Context& ctx, const Byte* data, size_t size)
 {
-	// Stores the 8 blocks of size 64
-	int64 A = 0x6a09e667f3bcc908;
-	int64 B = 0xbb67ae8584caa73b;
-	int64 C = 0x3c6ef372fe94f82b;
-	int64 D = 0xa54ff53a5f1d36f1;
-	int64 E = 0x510e527fade682d1;
-	int64 F = 0x9b05688c2b3e6c1f;
-	int64 G = 0x1f83d9abfb41bd6b;
-	int64 H = 0x5be0cd19137e2179;
-
-	int64 AA, BB, CC, DD, EE, FF, GG, HH;
-
-	stringstream fixedstream;
-
-	// Traverse the string S
-	for (int i = 0;
-		i < myString.size(); ++i) {
-
-		// Add the character to stream
-		fixedstream << bitset<8>(myString[i]);
+	int64 bits = (int64)size << 3;
+	ctx.lengthHigh += ((int64)size >> 61) + (ctx.lengthLow + bits < ctx.lengthLow);
+	ctx.lengthLow += bits;
+
+	// Complete the buffered block first
+	if (ctx.buffered > 0) {
+		size_t take = min(size, 128 - ctx.buffered);
+		for (size_t i = 0; i < take; i++)
+			ctx.buffer[ctx.buffered + i] = data[i];
+		ctx.buffered += take;
+		data += take;
+		size -= take;
+
+		if (ctx.buffered < 128)
+			return;
+
+		compressBlock(ctx.state, ctx.buffer);
+		ctx.buffered = 0;
 	}
 
-	// Stores string of size 1024
-	string s1024;
+	// Whole blocks are hashed straight
+	// from the input
+	for (; size >= 128; data += 128, size -= 128)
+		compressBlock(ctx.state, data);
+
+	for (size_t i = 0; i < size; i++)
+		ctx.buffer[i] = data[i];
+	ctx.buffered = size;
+}
+
+// Function to pad the message and write
+// the 64 byte digest
+constexpr void sha512Final(SHA512Context& ctx, unsigned char digest[64])
+{
+	// The rest, a 1 bit, zeros and the 128 bit
+	// length fill one block, or two when fewer
+	// than 17 bytes are left after the rest
+	unsigned char tail[256] = { 0 };
+	size_t rest = ctx.buffered;
+	for (size_t i = 0; i < rest; i++)
+		tail[i] = ctx.buffer[i];
+	tail[rest] = 0x80;
+
+	size_t tailsize = (rest + 17 <= 128) ? 128 : 256;
+	storeWord(tail + tailsize - 16, ctx.lengthHigh);
+	storeWord(tail + tailsize - 8, ctx.lengthLow);
+
+	for (size_t i = 0; i < tailsize; i += 128)
+		compressBlock(ctx.state, tail + i);
+
+	for (int i = 0; i < 8; i++)
+		storeWord(digest + 8 * i, ctx.state[i]);
+}
+
+// Digest as a value, so it can be returned
+// from a constexpr function
+struct SHA512Digest {
+	unsigned char bytes[64] = {};
+};
+
+// Function to hash size bytes in one call,
+// at compile time or at run time
+template <typename Byte>
+constexpr SHA512Digest sha512Digest(const Byte* data, size_t size)
+{
+	SHA512Context ctx;
+	SHA512Digest result;
+
+	sha512Init(ctx);
+	sha512Update(ctx, data, size);
+	sha512Final(ctx, result.bytes);
 
-	// Stores the string in the
-	// fixedstream
-	s1024 = fixedstream.str();
+	return result;
+}
 
-	// Stores the length of string
-	int orilen = s1024.length();
-	int tobeadded;
+// Function to hash a string literal without
+// its terminating zero, for example
+// constexpr SHA512Digest d = sha512Literal("abc");
+template <size_t N>
+constexpr SHA512Digest sha512Literal(const char (&text)[N])
+{
+	return sha512Digest(text, N - 1);
+}
 
-	// Find modded string length
-	int modded = s1024.length() % 1024;
+// The compiler checks the core against the
+// FIPS 180-2 digest of "abc"
+static_assert(sha512Literal("abc").bytes[0] == 0xdd
+			&& sha512Literal("abc").bytes[63] == 0x9f,
+			"SHA-512 core gives a wrong digest");
 
-	// If 1024-128 is greater than modded
-	if (1024 - modded >= 128) {
-		tobeadded = 1024 - modded;
+// Function to write a digest as 128
+// hexadecimal characters, no terminator
+constexpr void digestToHex(const unsigned char digest[64], char hex[128])
+{
+	for (int i = 0; i < 64; i++) {
+		hex[2 * i] = HexDigits[digest[i] >> 4];
+		hex[2 * i + 1] = HexDigits[digest[i] & 15];
 	}
+}
 
-	// Else if 1024-128 is less than modded
-	else if (1024 - modded < 128) {
-		tobeadded = 2048 - modded;
+// Function to read 128 hexadecimal characters
+// of either case back into a digest
+constexpr bool hexToDigest(const char hex[128], unsigned char digest[64])
+{
+	for (int i = 0; i < 64; i++) {
+		int high = HexValues.value[(unsigned char)hex[2 * i]];
+		int low = HexValues.value[(unsigned char)hex[2 * i + 1]];
+		if (high < 0 || low < 0)
+			return false;
+		digest[i] = (high << 4) | low;
 	}
+	return true;
+}
+
+// Function to write a digest as a string
+// of 128 hexadecimal characters
+string digestToHex(const unsigned char digest[64])
+{
+	char hex[128];
+	digestToHex(digest, hex);
+	return string(hex, 128);
+}
 
-	// Append 1 to string
-	s1024 += "1";
+// Function to compare two digests, every byte is
+// looked at so the time does not tell where
+// they differ
+bool digestsEqual(const unsigned char a[64], const unsigned char b[64])
+{
+	unsigned char difference = 0;
+	for (int i = 0; i < 64; i++)
+		difference |= a[i] ^ b[i];
+	return difference == 0;
+}
+
+// HMAC-SHA512 (RFC 2104): the inner hasher takes the
+// message, the outer one the inner digest
+struct HMACSHA512Context {
+	SHA512Context inner;
+	SHA512Context outer;
+};
 
-	// Append tobeadded-129 zeros
-	// in the string
-	for (int y = 0; y < tobeadded - 129; y++) {
-		s1024 += "0";
+// Function to start a MAC under the given key,
+// a key longer than a block is hashed first
+void hmacSha512Init(HMACSHA512Context& ctx, const unsigned char* key, size_t keySize)
+{
+	unsigned char block[128] = { 0 };
+
+	if (keySize > 128) {
+		SHA512Digest hashed = sha512Digest(key, keySize);
+		memcpy(block, hashed.bytes, 64);
+	}
+	else {
+		memcpy(block, key, keySize);
 	}
 
-	// Stores the binary representation
-	// of string length
-	string lengthbits
-		= std::bitset<128>(orilen).to_string();
+	unsigned char pad[128];
 
-	// Append the lengthbits to string
-	s1024 += lengthbits;
+	for (int i = 0; i < 128; i++)
+		pad[i] = block[i] ^ 0x36;
+	sha512Init(ctx.inner);
+	sha512Update(ctx.inner, pad, 128);
 
-	// Find the count of chunks of
-	// size 1024 each
-	int blocksnumber = s1024.length() / 1024;
+	for (int i = 0; i < 128; i++)
+		pad[i] = block[i] ^ 0x5c;
+	sha512Init(ctx.outer);
+	sha512Update(ctx.outer, pad, 128);
+}
 
-	// Stores the numbering of chunks
-	int chunknum = 0;
+// Function to add the next size bytes
+// of the message
+void hmacSha512Update(HMACSHA512Context& ctx, const unsigned char* data, size_t size)
+{
+	sha512Update(ctx.inner, data, size);
+}
 
-	// Stores hash value of each blocks
-	string Blocks[blocksnumber];
+// Function to write the 64 byte MAC
+void hmacSha512Final(HMACSHA512Context& ctx, unsigned char mac[64])
+{
+	unsigned char innerDigest[64];
+	sha512Final(ctx.inner, innerDigest);
 
-	// Traverse the string s1024
-	for (int i = 0; i < s1024.length();
-		i += 1024, ++chunknum) {
-		Blocks[chunknum] = s1024.substr(i, 1024);
-	}
+	sha512Update(ctx.outer, innerDigest, 64);
+	sha512Final(ctx.outer, mac);
+}
 
-	// Traverse the array Blocks[]
-	for (int letsgo = 0;
-		letsgo < blocksnumber;
-		++letsgo) {
-
-		// Divide the current string
-		// into 80 blocks size 16 each
-		separator(Blocks[letsgo]);
-
-		AA = A;
-		BB = B;
-		CC = C;
-		DD = D;
-		EE = E;
-		FF = F;
-		GG = G;
-		HH = H;
-
-		int count = 0;
-
-		// Find hash values
-		for (int i = 0; i < 10; i++) {
-
-			// Find the Hash Values
-
-			Func(A, B, C, D, E, F, G, H, count);
-			count++;
-			Func(H, A, B, C, D, E, F, G, count);
-			count++;
-			Func(G, H, A, B, C, D, E, F, count);
-			count++;
-			Func(F, G, H, A, B, C, D, E, count);
-			count++;
-			Func(E, F, G, H, A, B, C, D, count);
-			count++;
-			Func(D, E, F, G, H, A, B, C, count);
-			count++;
-			Func(C, D, E, F, G, H, A, B, count);
-			count++;
-			Func(B, C, D, E, F, G, H, A, count);
-			count++;
-		}
-
-		// Update the value of A, B, C,
-		// D, E, F, G, H
-
-		A += AA;
-		B += BB;
-		C += CC;
-		D += DD;
-		E += EE;
-		F += FF;
-		G += GG;
-		H += HH;
-	}
+// Function to convert the hash value
+// of a given string
+string SHA512(string myString)
+{
+	SHA512Context ctx;
+	unsigned char digest[64];
+
+	sha512Init(ctx);
+	sha512Update(ctx, (const unsigned char*)myString.data(), myString.size());
+	sha512Final(ctx, digest);
 
-	stringstream output;
-
-	// Print the hexadecimal value of
-	// strings as the resultant SHA-512
-	output << decimaltohex(A);
-	output << decimaltohex(B);
-	output << decimaltohex(C);
-	output << decimaltohex(D);
-	output << decimaltohex(E);
-	output << decimaltohex(F);
-	output << decimaltohex(G);
-	output << decimaltohex(H);
-
-	// Return the string
-	return output.str();
+	// Return the hexadecimal value as
+	// the resultant SHA-512
+	return digestToHex(digest);
 }
 
-std::string generateSHA512Hash(const std::string& inputFilePath, const std::string& outputFilePath) {
-    // Read the content of the text file
-    std::ifstream inputFile(inputFilePath);
+bool generateSHA512Digest(const std::string& inputFilePath, unsigned char digest[64]) {
+    // Hash the file a chunk at a time, so memory use
+    // does not depend on the file size
+    std::ifstream inputFile(inputFilePath, std::ios::binary);
     if (!inputFile.is_open()) {
         std::cerr << "Error opening file: " << inputFilePath << std::endl;
-        return "";
+        return false;
+    }
+
+    SHA512Context ctx;
+    sha512Init(ctx);
+
+    std::vector<char> buffer(1 << 20);
+    while (inputFile.read(buffer.data(), buffer.size()) || inputFile.gcount() > 0) {
+        sha512Update(ctx, (const unsigned char*)buffer.data(), inputFile.gcount());
+    }
+
+    if (inputFile.bad()) {
+        std::cerr << "Error reading file: " << inputFilePath << std::endl;
+        return false;
     }
 
-    std::stringstream buffer;
-    buffer << inputFile.rdbuf();
-    std::string fileContent = buffer.str();
+    sha512Final(ctx, digest);
+    return true;
+}
 
-    // Calculate SHA-512 hash
-    std::string hashResult = SHA512(fileContent);
+bool saveSHA512Hash(const unsigned char digest[64], const std::string& outputFilePath) {
+    char hashResult[128];
+    digestToHex(digest, hashResult);
 
     // Save the hash to the output file
     std::ofstream outputFile(outputFilePath);
     if (!outputFile.is_open()) {
         std::cerr << "Error opening " << outputFilePath << " for writing." << std::endl;
-        return "";
+        return false;
     }
 
-    outputFile << hashResult;
+    outputFile.write(hashResult, 128);
     outputFile.close();
 
     std::cout << "Hash saved in " << outputFilePath << std::endl;
 
-    return hashResult;
+    return true;
 }
 
+bool loadSHA512Hash(const std::string& inputFilePath, unsigned char digest[64]) {
+    // Read a hash written by saveSHA512Hash back
+    std::ifstream inputFile(inputFilePath);
+    char hashResult[128];
+
+    if (!inputFile.read(hashResult, 128)) {
+        return false;
+    }
+
+    return hexToDigest(hashResult, digest);
+}
@@ -0,0 +1,35 @@
+// C interface to the SHA-512 code, for the transfer
+// client and server. Build them with
+// gcc server5.c sha512Interface.cpp -lstdc++
+#ifndef SHA512_H
+#define SHA512_H
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Starts a message, the handle is freed by sha512_end
+void* sha512_begin(void);
+void sha512_add(void* ctx, const void* data, size_t size);
+void sha512_end(void* ctx, unsigned char digest[64]);
+
+// Hashes count whole files, several at once, into
+// digests, 64 bytes each. 0 if a file can't be read.
+int sha512_files(const char* const* paths, size_t count, unsigned char* digests);
+
+// Tree hash of sha512Tree.cpp. sha512_tree_file hashes
+// a file of count chunks of chunk_size bytes into their
+// leaves, 64 bytes each, and the root. 0 if the file
+// can't be read or has another number of chunks.
+int sha512_tree_file(const char* path, size_t chunk_size, size_t count,
+                     unsigned char* leaves, unsigned char root[64]);
+// Starts the leaf of one chunk, ended by sha512_end
+void* sha512_leaf_begin(void);
+void sha512_tree_root(const unsigned char* leaves, size_t count, unsigned char root[64]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
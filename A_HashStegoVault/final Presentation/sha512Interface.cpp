@@ -0,0 +1,75 @@
+// C interface to the SHA-512 code, see sha512.h. The
+// hashing files are pulled in the way main.cpp does,
+// so this is the one file the client and server link
+#include "sha512.cpp"
+#include "sha512MultiBuffer.cpp"
+#include "sha512Tree.cpp"
+#include "sha512.h"
+
+extern "C" void* sha512_begin(void)
+{
+	SHA512Context* ctx = new SHA512Context;
+	sha512Init(*ctx);
+	return ctx;
+}
+
+extern "C" void sha512_add(void* ctx, const void* data, size_t size)
+{
+	sha512Update(*(SHA512Context*)ctx, (const unsigned char*)data, size);
+}
+
+extern "C" void sha512_end(void* ctx, unsigned char digest[64])
+{
+	sha512Final(*(SHA512Context*)ctx, digest);
+	delete (SHA512Context*)ctx;
+}
+
+// Function to hash whole files through the job
+// manager, digests gets 64 bytes per file
+extern "C" int sha512_files(const char* const* paths, size_t count, unsigned char* digests)
+{
+	vector<string> inputFilePaths(paths, paths + count);
+	vector<string> hashes = generateSHA512Hashes(inputFilePaths);
+
+	for (size_t i = 0; i < count; i++) {
+		// Unreadable files come back with an empty hash
+		if (hashes[i].size() != 128 || !hexToDigest(hashes[i].data(), digests + 64 * i))
+			return 0;
+	}
+	return 1;
+}
+
+// Function to tree hash a file in chunks of chunkSize
+// on several threads, leaves gets 64 bytes for each of
+// the count chunks
+extern "C" int sha512_tree_file(const char* path, size_t chunkSize, size_t count,
+								unsigned char* leaves, unsigned char root[64])
+{
+	SHA512Tree tree;
+	if (!sha512TreeHashFile(path, tree, chunkSize) || tree.leaves.size() != count)
+		return 0;
+
+	for (size_t i = 0; i < count; i++)
+		memcpy(leaves + 64 * i, tree.leaves[i].bytes, 64);
+	memcpy(root, tree.root.bytes, 64);
+	return 1;
+}
+
+// Function to start hashing one chunk as a leaf,
+// finished by sha512_end like any other message
+extern "C" void* sha512_leaf_begin(void)
+{
+	SHA512Context* ctx = (SHA512Context*)sha512_begin();
+	sha512Update(*ctx, &TreeLeafPrefix, 1);
+	return ctx;
+}
+
+// Function to combine count leaves into their root
+extern "C" void sha512_tree_root(const unsigned char* leaves, size_t count, unsigned char root[64])
+{
+	vector<SHA512Digest> level(count);
+	for (size_t i = 0; i < count; i++)
+		memcpy(level[i].bytes, leaves + 64 * i, 64);
+
+	memcpy(root, sha512TreeRoot(level).bytes, 64);
+}
@@ -0,0 +1,317 @@
+// Multi-buffer SHA-512: one message per 64 bit lane,
+// four messages hashed by the same instructions
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SHA512_MULTI_BUFFER_X86 1
+#endif
+using namespace std;
+
+// A message handed to the job manager,
+// digest is filled in when it is done
+struct SHA512Job {
+	const unsigned char* data;
+	size_t size;
+	unsigned char digest[64];
+};
+
+// One lane of the job manager: the job, the next
+// block to hash and the padded last blocks
+struct SHA512Lane {
+	SHA512Job* job;
+	int64 state[8];
+	size_t block;
+	size_t blocksnumber;
+	size_t tailsize;
+	unsigned char tail[256];
+};
+
+// Function to put a job on a lane
+void laneStart(SHA512Lane& lane, SHA512Job* job)
+{
+	SHA512Context ctx;
+	sha512Init(ctx);
+
+	lane.job = job;
+	memcpy(lane.state, ctx.state, sizeof(lane.state));
+	lane.block = 0;
+	lane.blocksnumber = job->size / 128;
+
+	// Same padding as sha512Final
+	size_t rest = job->size % 128;
+	memset(lane.tail, 0, sizeof(lane.tail));
+	memcpy(lane.tail, job->data + 128 * lane.blocksnumber, rest);
+	lane.tail[rest] = 0x80;
+
+	lane.tailsize = (rest + 17 <= 128) ? 128 : 256;
+	storeWord(lane.tail + lane.tailsize - 16, (int64)(job->size >> 61));
+	storeWord(lane.tail + lane.tailsize - 8, (int64)job->size << 3);
+}
+
+// Function to find the block a lane hashes next
+const unsigned char* laneBlock(const SHA512Lane& lane)
+{
+	if (lane.block < lane.blocksnumber)
+		return lane.job->data + 128 * lane.block;
+	return lane.tail + 128 * (lane.block - lane.blocksnumber);
+}
+
+// Function to check if a lane has hashed its last block
+bool laneDone(const SHA512Lane& lane)
+{
+	return lane.block == lane.blocksnumber + lane.tailsize / 128;
+}
+
+#ifdef SHA512_MULTI_BUFFER_X86
+__attribute__((target("avx2"), always_inline)) inline
+__m256i rotate_right4(__m256i x, int n)
+{
+	return _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - n));
+}
+
+// Function to load word t of four blocks,
+// one block per lane
+__attribute__((target("avx2"), always_inline)) inline
+__m256i loadWord4(const unsigned char* blocks[4], int t)
+{
+	return _mm256_set_epi64x(loadWord(blocks[3] + 8 * t), loadWord(blocks[2] + 8 * t),
+							 loadWord(blocks[1] + 8 * t), loadWord(blocks[0] + 8 * t));
+}
+
+// Function to run the compression over one block
+// of each of four lanes, the rounds are the ones
+// of Func on four words at once
+__attribute__((target("avx2")))
+void compressBlocks4(SHA512Lane* lanes[4], const unsigned char* blocks[4])
+{
+	__m256i W[80];
+
+	for (int t = 0; t < 16; t++)
+		W[t] = loadWord4(blocks, t);
+
+	for (int g = 16; g < 80; ++g) {
+		__m256i WordA = _mm256_xor_si256(_mm256_xor_si256(rotate_right4(W[g - 2], 19),
+								rotate_right4(W[g - 2], 61)), _mm256_srli_epi64(W[g - 2], 6));
+		__m256i WordC = _mm256_xor_si256(_mm256_xor_si256(rotate_right4(W[g - 15], 1),
+								rotate_right4(W[g - 15], 8)), _mm256_srli_epi64(W[g - 15], 7));
+		W[g] = _mm256_add_epi64(_mm256_add_epi64(WordA, W[g - 7]),
+								_mm256_add_epi64(WordC, W[g - 16]));
+	}
+
+	// Gather the hash values lane by lane
+	__m256i S[8];
+	for (int i = 0; i < 8; i++)
+		S[i] = _mm256_set_epi64x(lanes[3]->state[i], lanes[2]->state[i],
+								 lanes[1]->state[i], lanes[0]->state[i]);
+
+	__m256i a = S[0], b = S[1], c = S[2], d = S[3];
+	__m256i e = S[4], f = S[5], g = S[6], h = S[7];
+
+	for (int K = 0; K < 80; K++) {
+		__m256i sE = _mm256_xor_si256(_mm256_xor_si256(rotate_right4(e, 14),
+							rotate_right4(e, 18)), rotate_right4(e, 41));
+		__m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+		__m256i T1 = _mm256_add_epi64(_mm256_add_epi64(h, sE),
+						_mm256_add_epi64(_mm256_add_epi64(ch, W[K]),
+										 _mm256_set1_epi64x(Constants[K])));
+
+		__m256i sA = _mm256_xor_si256(_mm256_xor_si256(rotate_right4(a, 28),
+							rotate_right4(a, 34)), rotate_right4(a, 39));
+		__m256i mj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, b),
+							_mm256_and_si256(b, c)), _mm256_and_si256(c, a));
+		__m256i T2 = _mm256_add_epi64(sA, mj);
+
+		h = g;
+		g = f;
+		f = e;
+		e = _mm256_add_epi64(d, T1);
+		d = c;
+		c = b;
+		b = a;
+		a = _mm256_add_epi64(T1, T2);
+	}
+
+	S[0] = _mm256_add_epi64(S[0], a);
+	S[1] = _mm256_add_epi64(S[1], b);
+	S[2] = _mm256_add_epi64(S[2], c);
+	S[3] = _mm256_add_epi64(S[3], d);
+	S[4] = _mm256_add_epi64(S[4], e);
+	S[5] = _mm256_add_epi64(S[5], f);
+	S[6] = _mm256_add_epi64(S[6], g);
+	S[7] = _mm256_add_epi64(S[7], h);
+
+	// Scatter them back
+	for (int i = 0; i < 8; i++) {
+		int64 words[4];
+		_mm256_storeu_si256((__m256i*)words, S[i]);
+		for (int lane = 0; lane < 4; lane++)
+			lanes[lane]->state[i] = words[lane];
+	}
+}
+#endif
+
+// Function to check if the cpu can run four lanes
+bool sha512MultiBufferSupported()
+{
+#ifdef SHA512_MULTI_BUFFER_X86
+	__builtin_cpu_init();
+	return __builtin_cpu_supports("avx2");
+#else
+	return false;
+#endif
+}
+
+// Job manager: takes the jobs in order, keeps four
+// lanes busy and puts a new job on a lane as soon
+// as its last block is hashed. Idle lanes hash a
+// spare block whose result is thrown away.
+void sha512MultiBuffer(vector<SHA512Job>& jobs)
+{
+	if (!sha512MultiBufferSupported()) {
+		for (size_t i = 0; i < jobs.size(); i++) {
+			SHA512Context ctx;
+			sha512Init(ctx);
+			sha512Update(ctx, jobs[i].data, jobs[i].size);
+			sha512Final(ctx, jobs[i].digest);
+		}
+		return;
+	}
+
+#ifdef SHA512_MULTI_BUFFER_X86
+	SHA512Lane lanes[4];
+	SHA512Lane spare;
+	static const unsigned char empty[1] = { 0 };
+	SHA512Job spareJob = { empty, 0, {} };
+	laneStart(spare, &spareJob);
+
+	size_t next = 0;
+	int busy = 0;
+
+	for (int i = 0; i < 4; i++) {
+		lanes[i].job = NULL;
+		if (next < jobs.size()) {
+			laneStart(lanes[i], &jobs[next++]);
+			busy++;
+		}
+	}
+
+	while (busy > 0) {
+		SHA512Lane* active[4];
+		const unsigned char* blocks[4];
+
+		for (int i = 0; i < 4; i++) {
+			active[i] = lanes[i].job ? &lanes[i] : &spare;
+			blocks[i] = laneBlock(*active[i]);
+		}
+
+		compressBlocks4(active, blocks);
+
+		for (int i = 0; i < 4; i++) {
+			if (!lanes[i].job)
+				continue;
+
+			lanes[i].block++;
+			if (!laneDone(lanes[i]))
+				continue;
+
+			for (int w = 0; w < 8; w++)
+				storeWord(lanes[i].job->digest + 8 * w, lanes[i].state[w]);
+
+			lanes[i].job = NULL;
+			busy--;
+
+			if (next < jobs.size()) {
+				laneStart(lanes[i], &jobs[next++]);
+				busy++;
+			}
+		}
+
+		spare.block = 0;
+	}
+#endif
+}
+
+// Function to read a whole file into buffer, a
+// single allocation of the file size filled by pread
+bool readWholeFile(int fd, size_t size, vector<unsigned char>& buffer)
+{
+	buffer.resize(size);
+
+	for (size_t done = 0; done < size;) {
+		ssize_t n = pread(fd, buffer.data() + done, size - done, done);
+		if (n <= 0)
+			return false;
+		done += n;
+	}
+	return true;
+}
+
+// Function to hash many files at once, the files
+// are read a group at a time and each group is
+// hashed through the job manager. A file over
+// 16MB is hashed on its own a buffer at a time,
+// so memory stays bounded.
+vector<string> generateSHA512Hashes(const vector<string>& inputFilePaths)
+{
+	const size_t group = 64;
+	const unsigned long long groupBytes = 64ULL << 20;
+	const unsigned long long fileLimit = 16ULL << 20;
+	vector<string> hashes(inputFilePaths.size());
+
+	for (size_t first = 0; first < inputFilePaths.size();) {
+		vector<vector<unsigned char>> contents;
+		vector<size_t> owners;
+		unsigned long long bytes = 0;
+		size_t i;
+
+		for (i = first; i < inputFilePaths.size() && owners.size() < group && bytes < groupBytes; i++) {
+			int fd = open(inputFilePaths[i].c_str(), O_RDONLY);
+			struct stat info;
+			if (fd < 0 || fstat(fd, &info) != 0) {
+				cerr << "Error opening file: " << inputFilePaths[i] << endl;
+				if (fd >= 0)
+					close(fd);
+				continue;
+			}
+
+			if ((unsigned long long)info.st_size > fileLimit) {
+				close(fd);
+				unsigned char digest[64];
+				if (generateSHA512Digest(inputFilePaths[i], digest))
+					hashes[i] = digestToHex(digest);
+				continue;
+			}
+
+			vector<unsigned char> buffer;
+			bool ok = readWholeFile(fd, info.st_size, buffer);
+			close(fd);
+			if (!ok) {
+				cerr << "Error reading file: " << inputFilePaths[i] << endl;
+				continue;
+			}
+
+			bytes += buffer.size();
+			contents.push_back(move(buffer));
+			owners.push_back(i);
+		}
+
+		vector<SHA512Job> jobs(contents.size());
+		for (size_t j = 0; j < contents.size(); j++) {
+			jobs[j].data = contents[j].data();
+			jobs[j].size = contents[j].size();
+		}
+
+		sha512MultiBuffer(jobs);
+
+		// Unreadable files keep an empty hash
+		for (size_t j = 0; j < jobs.size(); j++)
+			hashes[owners[j]] = digestToHex(jobs[j].digest);
+
+		first = i;
+	}
+
+	return hashes;
+}
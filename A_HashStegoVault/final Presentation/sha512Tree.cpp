@@ -0,0 +1,166 @@
+// Tree hash mode: the file is cut into fixed chunks,
+// the chunks are hashed on several threads and the
+// chunk digests are combined into a Merkle root
+#include <bits/stdc++.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+using namespace std;
+
+// Leaves and nodes are hashed with a different first
+// byte, so a node can never pass for a chunk
+const unsigned char TreeLeafPrefix = 0x00;
+const unsigned char TreeNodePrefix = 0x01;
+
+// A tree hash with the parameters it was made with
+struct SHA512Tree {
+	size_t chunkSize = 1 << 20;
+	unsigned long long fileSize = 0;
+	vector<SHA512Digest> leaves;
+	SHA512Digest root;
+};
+
+// Function to run work(0) .. work(jobs - 1) on a pool
+// of threads taking the next job from a shared counter
+void treeWorkers(int threadCount, size_t jobs, function<void(size_t)> work)
+{
+	if (threadCount <= 0)
+		threadCount = thread::hardware_concurrency();
+	threadCount = (int)min<size_t>(max(threadCount, 1), max<size_t>(jobs, 1));
+
+	atomic<size_t> next(0);
+	vector<thread> workers;
+
+	for (int i = 0; i < threadCount; i++) {
+		workers.push_back(thread([&]() {
+			for (size_t job; (job = next++) < jobs;)
+				work(job);
+		}));
+	}
+
+	for (size_t i = 0; i < workers.size(); i++)
+		workers[i].join();
+}
+
+// Function to hash one chunk as a leaf
+SHA512Digest treeLeaf(const unsigned char* data, size_t size)
+{
+	SHA512Context ctx;
+	SHA512Digest result;
+
+	sha512Init(ctx);
+	sha512Update(ctx, &TreeLeafPrefix, 1);
+	sha512Update(ctx, data, size);
+	sha512Final(ctx, result.bytes);
+
+	return result;
+}
+
+// Function to hash two children into their node
+SHA512Digest treeNode(const SHA512Digest& left, const SHA512Digest& right)
+{
+	SHA512Context ctx;
+	SHA512Digest result;
+
+	sha512Init(ctx);
+	sha512Update(ctx, &TreeNodePrefix, 1);
+	sha512Update(ctx, left.bytes, 64);
+	sha512Update(ctx, right.bytes, 64);
+	sha512Final(ctx, result.bytes);
+
+	return result;
+}
+
+// Function to combine the leaves level by level in
+// pairs, a node without a partner moves up unchanged.
+// No leaves is the tree of one empty chunk.
+SHA512Digest sha512TreeRoot(const vector<SHA512Digest>& leaves)
+{
+	if (leaves.empty())
+		return treeLeaf(NULL, 0);
+
+	vector<SHA512Digest> level = leaves;
+
+	while (level.size() > 1) {
+		vector<SHA512Digest> parents;
+
+		for (size_t i = 0; i < level.size(); i += 2) {
+			if (i + 1 < level.size())
+				parents.push_back(treeNode(level[i], level[i + 1]));
+			else
+				parents.push_back(level[i]);
+		}
+
+		level.swap(parents);
+	}
+
+	return level[0];
+}
+
+// Function to hash the given chunks of a file into
+// tree.leaves, each thread reads its own chunks
+bool treeHashChunks(const string& inputFilePath, SHA512Tree& tree,
+					const vector<size_t>& chunks, int threadCount)
+{
+	int fd = open(inputFilePath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		cerr << "Error opening file: " << inputFilePath << endl;
+		return false;
+	}
+
+	atomic<bool> ok(true);
+
+	treeWorkers(threadCount, chunks.size(), [&](size_t job) {
+		size_t chunk = chunks[job];
+		unsigned long long offset = (unsigned long long)chunk * tree.chunkSize;
+		size_t size = (size_t)min<unsigned long long>(tree.chunkSize, tree.fileSize - offset);
+
+		vector<unsigned char> buffer(size);
+		size_t done = 0;
+
+		while (done < size) {
+			ssize_t n = pread(fd, buffer.data() + done, size - done, offset + done);
+			if (n <= 0) {
+				ok = false;
+				return;
+			}
+			done += n;
+		}
+
+		tree.leaves[chunk] = treeLeaf(buffer.data(), size);
+	});
+
+	close(fd);
+
+	if (!ok)
+		cerr << "Error reading file: " << inputFilePath << endl;
+
+	return ok;
+}
+
+// Function to tree hash a whole file, an empty
+// file is a single empty chunk
+bool sha512TreeHashFile(const string& inputFilePath, SHA512Tree& tree,
+						size_t chunkSize = 1 << 20, int threadCount = 0)
+{
+	struct stat info;
+	if (chunkSize == 0 || stat(inputFilePath.c_str(), &info) != 0) {
+		cerr << "Error opening file: " << inputFilePath << endl;
+		return false;
+	}
+
+	tree.chunkSize = chunkSize;
+	tree.fileSize = info.st_size;
+
+	size_t chunkCount = max<unsigned long long>(1, (tree.fileSize + chunkSize - 1) / chunkSize);
+	tree.leaves.assign(chunkCount, SHA512Digest());
+
+	vector<size_t> chunks(chunkCount);
+	iota(chunks.begin(), chunks.end(), 0);
+
+	if (!treeHashChunks(inputFilePath, tree, chunks, threadCount))
+		return false;
+
+	tree.root = sha512TreeRoot(tree.leaves);
+	return true;
+}
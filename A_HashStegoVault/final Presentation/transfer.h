@@ -0,0 +1,178 @@
+// Framing for files sent from client5.c to server5.c.
+// Every file goes behind a header, numbers big endian:
+// magic (4), version (1), content type (1), name
+// length (2), payload length (8), SHA-512 of the
+// payload (64), then the name and the payload.
+// Many files can follow each other on one connection,
+// the server answers each with an acknowledgement, in
+// the order they were sent: magic (4), status (1),
+// three zero bytes, payload bytes stored (8).
+//
+// A file with TRANSFER_CHUNKED in its content type is
+// resumable. The flag is set exactly for the lengths
+// transfer_chunked takes, a frame where they disagree
+// is a bad header. After its name the sender waits for
+// the map of chunks the server already holds verified:
+// magic (4), chunk count (8), one bit per chunk, first
+// chunk in the high bit of the first byte. Then it
+// sends only the missing chunks, in order, each as
+// index (8), leaf digest of the chunk (64), the chunk.
+// A chunk that fails its digest is left missing and
+// the file is acknowledged TRANSFER_INCOMPLETE, the
+// verified chunks stay for the next try.
+// For such a file the header carries the root of the
+// sha512Tree.cpp tree over TRANSFER_CHUNK_SIZE chunks
+// instead of the SHA-512 of the payload: a leaf is the
+// SHA-512 of 0x00 and the chunk, a node the SHA-512 of
+// 0x01 and its two children, a node left without a
+// partner moves up as it is. The chunk size and the
+// TRANSFER_TREE_ARITY are fixed by the version, a
+// change to either needs a new one. The server keeps
+// the verified leaves, so it checks the root without
+// reading the file back.
+#ifndef TRANSFER_H
+#define TRANSFER_H
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+
+#define TRANSFER_MAGIC 0x53565446u  // "SVTF"
+#define TRANSFER_VERSION 1
+#define TRANSFER_HEADER_SIZE 80     // Bytes in front of the name
+#define TRANSFER_MAX_NAME 255
+#define TRANSFER_ACK_MAGIC 0x53565441u  // "SVTA"
+#define TRANSFER_ACK_SIZE 16
+#define TRANSFER_HAVE_MAGIC 0x53565448u  // "SVTH"
+#define TRANSFER_HAVE_SIZE 12           // Bytes in front of the map
+#define TRANSFER_CHUNKED 0x80
+#define TRANSFER_CHUNK_SIZE (4ULL << 20)  // Also the leaf size of the tree root
+#define TRANSFER_TREE_ARITY 2             // Children of a tree node
+#define TRANSFER_CHUNK_HEADER_SIZE 72
+
+enum transfer_type {
+    TRANSFER_BINARY = 0,
+    TRANSFER_BMP = 1,
+    TRANSFER_TEXT = 2,
+    TRANSFER_TYPES
+};
+
+// What became of a file. A rejected file's payload is still read past,
+// so the files after it arrive, except after TRANSFER_BAD_HEADER, where
+// the server can't find the next frame and closes the connection.
+enum transfer_status {
+    TRANSFER_STORED = 0,
+    TRANSFER_BAD_DIGEST = 1,
+    TRANSFER_TOO_LARGE = 2,
+    TRANSFER_NO_ROOM = 3,
+    TRANSFER_BAD_NAME = 4,
+    TRANSFER_FAILED = 5,
+    TRANSFER_BAD_HEADER = 6,
+    TRANSFER_INCOMPLETE = 7,
+    TRANSFER_BUSY = 8
+};
+
+struct transfer_header {
+    int version;
+    int type;
+    int name_length;
+    unsigned long long length;
+    unsigned char digest[64];
+};
+
+static inline void transfer_put(unsigned char *out, unsigned long long value, int size) {
+    for (int i = size - 1; i >= 0; i--) {
+        out[i] = value & 0xff;
+        value >>= 8;
+    }
+}
+
+static inline unsigned long long transfer_get(const unsigned char *in, int size) {
+    unsigned long long value = 0;
+    for (int i = 0; i < size; i++) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+static inline void transfer_encode(const struct transfer_header *header, unsigned char *out) {
+    transfer_put(out, TRANSFER_MAGIC, 4);
+    out[4] = header->version;
+    out[5] = header->type;
+    transfer_put(out + 6, header->name_length, 2);
+    transfer_put(out + 8, header->length, 8);
+    memcpy(out + 16, header->digest, 64);
+}
+
+// 0 when the bytes are not a header this side understands
+static inline int transfer_decode(const unsigned char *in, struct transfer_header *header) {
+    if (transfer_get(in, 4) != TRANSFER_MAGIC) {
+        return 0;
+    }
+    header->version = in[4];
+    header->type = in[5];
+    header->name_length = transfer_get(in + 6, 2);
+    header->length = transfer_get(in + 8, 8);
+    memcpy(header->digest, in + 16, 64);
+
+    return header->version == TRANSFER_VERSION && (header->type & ~TRANSFER_CHUNKED) < TRANSFER_TYPES
+        && header->name_length <= TRANSFER_MAX_NAME;
+}
+
+static inline void transfer_encode_ack(int status, unsigned long long stored, unsigned char *out) {
+    transfer_put(out, TRANSFER_ACK_MAGIC, 4);
+    out[4] = status;
+    out[5] = out[6] = out[7] = 0;
+    transfer_put(out + 8, stored, 8);
+}
+
+// 0 when the bytes are not an acknowledgement
+static inline int transfer_decode_ack(const unsigned char *in, int *status, unsigned long long *stored) {
+    if (transfer_get(in, 4) != TRANSFER_ACK_MAGIC) {
+        return 0;
+    }
+    *status = in[4];
+    *stored = transfer_get(in + 8, 8);
+    return 1;
+}
+
+static inline const char *transfer_status_text(int status) {
+    switch (status) {
+    case TRANSFER_STORED: return "stored";
+    case TRANSFER_BAD_DIGEST: return "the data does not match its SHA-512";
+    case TRANSFER_TOO_LARGE: return "over the size limit";
+    case TRANSFER_NO_ROOM: return "no room on the server";
+    case TRANSFER_BAD_NAME: return "no usable name";
+    case TRANSFER_FAILED: return "the server could not store it";
+    case TRANSFER_BAD_HEADER: return "bad header";
+    case TRANSFER_INCOMPLETE: return "some chunks failed their SHA-512, send it again to resume";
+    case TRANSFER_BUSY: return "another sender is sending the same file";
+    }
+    return "unknown status";
+}
+
+// Files over one chunk go in chunks, so they can be resumed
+static inline int transfer_chunked(unsigned long long length) {
+    return length > TRANSFER_CHUNK_SIZE;
+}
+
+static inline unsigned long long transfer_chunks(unsigned long long length) {
+    return (length + TRANSFER_CHUNK_SIZE - 1) / TRANSFER_CHUNK_SIZE;
+}
+
+static inline int transfer_has_chunk(const unsigned char *map, unsigned long long chunk) {
+    return (map[chunk >> 3] >> (7 - (chunk & 7))) & 1;
+}
+
+// Content type from the file name extension
+static inline int transfer_type_of(const char *name) {
+    const char *dot = strrchr(name, '.');
+    if (dot != NULL && strcasecmp(dot, ".bmp") == 0) {
+        return TRANSFER_BMP;
+    }
+    if (dot != NULL && strcasecmp(dot, ".txt") == 0) {
+        return TRANSFER_TEXT;
+    }
+    return TRANSFER_BINARY;
+}
+
+#endif
@@ -1,13 +1,69 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <arpa/inet.h>
 
-#define SIZE 1024
+#define SIZE (1 << 20)
+#define PIPE_SIZE (1 << 20)
 
+// The data goes from the socket into a pipe and from the pipe into the
+// file without being copied to user space. 1 at the end of the data,
+// -1 on an error, -2 when splice can't be used here and nothing was
+// moved yet.
+int splice_file(int sockfd, int fd) {
+    int pipefd[2];
+    int moved_any = 0;
+
+    if (pipe(pipefd) < 0) {
+        return -2;
+    }
+    fcntl(pipefd[1], F_SETPIPE_SZ, PIPE_SIZE);
+
+    while (1) {
+        ssize_t n = splice(sockfd, NULL, pipefd[1], NULL, PIPE_SIZE, SPLICE_F_MOVE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            int state = 1;
+            if (n < 0) {
+                state = (errno == EINVAL || errno == ENOSYS) && !moved_any ? -2 : -1;
+                if (state == -1) {
+                    perror("[-]Error in receiving file.");
+                }
+            }
+            close(pipefd[0]);
+            close(pipefd[1]);
+            return state;
+        }
+
+        while (n > 0) {
+            ssize_t written = splice(pipefd[0], NULL, fd, NULL, n, SPLICE_F_MOVE);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                perror("[-]Error in writing to file.");
+                close(pipefd[0]);
+                close(pipefd[1]);
+                return -1;
+            }
+            n -= written;
+        }
+        moved_any = 1;
+    }
+}
+
+// Unframed: the first recv takes the extension and can take the
+// start of the content with it. The framed protocol that fixes this is
+// transfer.h in final Presentation, used by server5.c there.
 void write_file(int sockfd) {
     int n;
-    FILE *fp;
+    int fd;
     char filename[20] = "recv."; // Assuming a maximum extension length of 9 characters
     char extension[10]; // Assuming a maximum extension length of 9 characters
 
@@ -22,31 +78,45 @@ void write_file(int sockfd) {
     // Append received extension to the filename
     strcat(filename, extension);
 
-    unsigned char buffer[SIZE];
-
-    fp = fopen(filename, "wb"); // Open file in binary mode
-    if (fp == NULL) {
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
         perror("[-]Error in opening file.");
         exit(1);
     }
 
-    while (1) {
-        n = recv(sockfd, buffer, SIZE, 0);
-        if (n <= 0) {
-            if (n < 0) {
-                perror("[-]Error in receiving file.");
-            }
-            break;
+    if (splice_file(sockfd, fd) == -2) {
+        // No splice for this socket or file, copy through a buffer
+        unsigned char *buffer = malloc(SIZE);
+        if (buffer == NULL) {
+            perror("[-]Error in allocating buffer");
+            exit(1);
         }
-        size_t written = fwrite(buffer, 1, n, fp);
-        if (written < n) {
-            perror("[-]Error in writing to file.");
-            break;
+
+        while (1) {
+            n = recv(sockfd, buffer, SIZE, 0);
+            if (n <= 0) {
+                if (n < 0) {
+                    perror("[-]Error in receiving file.");
+                }
+                break;
+            }
+            ssize_t done = 0;
+            while (done < n) {
+                ssize_t written = write(fd, buffer + done, n - done);
+                if (written < 0) {
+                    perror("[-]Error in writing to file.");
+                    break;
+                }
+                done += written;
+            }
+            if (done < n) {
+                break;
+            }
         }
-        bzero(buffer, SIZE);
+        free(buffer);
     }
 
-    fclose(fp);
+    close(fd);
 }
 
 
@@ -58,7 +128,6 @@ int main() {
     int sockfd, new_sock;
     struct sockaddr_in server_addr, new_addr;
     socklen_t addr_size;
-    char buffer[SIZE];
 
     sockfd = socket(AF_INET, SOCK_STREAM, 0);
     if (sockfd < 0) {